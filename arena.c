@@ -0,0 +1,130 @@
+// arena.c: Region allocator backing everything that belongs to one command line
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "arena.h"
+
+// first block is sized so that an ordinary command line never needs a second one
+#define ARENA_FIRST_BLOCK 8192
+#define ARENA_MAX_BLOCK (1 << 20)
+#define ARENA_ALIGN 16
+
+static size_t align_up(size_t size)
+{
+	return (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+}
+
+// payload starts right after the (aligned) block header
+static char *block_data(ArenaBlock *block)
+{
+	return (char *)block + align_up(sizeof(ArenaBlock));
+}
+
+static ArenaBlock *new_block(size_t size)
+{
+	ArenaBlock *block = malloc(align_up(sizeof(ArenaBlock)) + size);
+	if (block == NULL)
+	{
+		perror("mumsh");
+		exit(1);
+	}
+	block->next = NULL;
+	block->size = size;
+	block->used = 0;
+	return block;
+}
+
+/**
+ * Create an empty arena. The Arena header lives in the first block,
+ * so one malloc() is all it takes for a typical command line.
+ * @return the new arena
+ */
+Arena *arena_create(void)
+{
+	ArenaBlock *block = new_block(ARENA_FIRST_BLOCK);
+	Arena *arena = (Arena *)block_data(block);
+	block->used = align_up(sizeof(Arena));
+	arena->blocks = block;
+	arena->next_size = ARENA_FIRST_BLOCK * 2;
+	arena->refs = 1;
+	return arena;
+}
+
+/**
+ * Allocate zero-filled memory from the arena.
+ * Never fails: running out of memory terminates the shell, as calloc() would have
+ * left us with nothing sensible to do either.
+ * @param arena the arena
+ * @param size number of bytes
+ * @return pointer to the memory, aligned for any type
+ */
+void *arena_alloc(Arena *arena, size_t size)
+{
+	size = align_up(size);
+	ArenaBlock *block = arena->blocks;
+	if (block->size - block->used < size)
+	{
+		// oversized requests get a block of their own, so that they don't
+		// waste the remainder of the current block
+		if (size > arena->next_size / 2)
+		{
+			block = new_block(size);
+			block->next = arena->blocks->next;
+			arena->blocks->next = block;
+		}
+		else
+		{
+			block = new_block(arena->next_size);
+			block->next = arena->blocks;
+			arena->blocks = block;
+			if (arena->next_size < ARENA_MAX_BLOCK)
+				arena->next_size *= 2;
+		}
+	}
+	void *ptr = block_data(block) + block->used;
+	block->used += size;
+	memset(ptr, 0, size);
+	return ptr;
+}
+
+/**
+ * Copy len bytes of str into the arena and NUL-terminate them.
+ */
+char *arena_strndup(Arena *arena, const char *str, size_t len)
+{
+	char *copy = arena_alloc(arena, len + 1);
+	memcpy(copy, str, len);
+	return copy;
+}
+
+/**
+ * Take one more reference to the arena, for another job living in it.
+ */
+void arena_retain(Arena *arena)
+{
+	arena->refs++;
+}
+
+/**
+ * Drop a reference to the arena. The last one releases every allocation
+ * made from it, including the arena itself.
+ */
+void arena_destroy(Arena *arena)
+{
+	if (arena == NULL || --arena->refs > 0)
+		return;
+	ArenaBlock *block = arena->blocks;
+	ArenaBlock *first = NULL;
+	while (block != NULL)
+	{
+		ArenaBlock *next = block->next;
+		// the block holding the Arena header must go last
+		if ((char *)arena >= block_data(block) && (char *)arena < block_data(block) + block->size)
+			first = block;
+		else
+			free(block);
+		block = next;
+	}
+	free(first);
+}
@@ -0,0 +1,32 @@
+// arena.h: Region allocator backing everything that belongs to one command line
+// A Job and all of its Tasks, argv strings and parser scratch live in one arena,
+// which is released as a whole when the job is reaped. The jobs of one list
+// ("a; b & c") share the arena of their line, which goes with the last of them.
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+// Blocks are chained newest-first; allocation only ever touches the head block.
+typedef struct _arena_block
+{
+	struct _arena_block *next;
+	size_t size;
+	size_t used;
+} ArenaBlock;
+
+typedef struct _arena
+{
+	ArenaBlock *blocks;
+	size_t next_size;
+	int refs;
+} Arena;
+
+Arena *arena_create(void);
+void *arena_alloc(Arena *arena, size_t size);
+char *arena_strndup(Arena *arena, const char *str, size_t len);
+void arena_retain(Arena *arena);
+void arena_destroy(Arena *arena);
+
+#endif
@@ -0,0 +1,76 @@
+// ast.h: Syntax tree produced by parse() and consumed by execute()
+// Words are kept as length-tagged slices of the command line; nothing is
+// copied until expand_task() removes the quotes.
+
+#ifndef AST_H
+#define AST_H
+
+#include <stddef.h>
+
+// redirection types; the first three double as prepare_fd() modes
+#define REDIR_IN 1
+#define REDIR_OUT 2
+#define REDIR_APPEND 3
+#define REDIR_HEREDOC 4    // <<WORD and <<-WORD, the body follows the line
+#define REDIR_HERESTRING 5 // <<<WORD
+
+// how a pipeline of a list follows the one before it
+#define LIST_SEQ 0 // ';' or '&': always runs
+#define LIST_AND 1 // "&&": runs if the one before succeeded
+#define LIST_OR 2  // "||": runs if it failed
+
+// A slice of the command line. quoted is 0, '\'' or '"'.
+typedef struct _word_part
+{
+	const char *text;
+	size_t len;
+	int quoted;
+	struct _word_part *next;
+} WordPart;
+
+// A word is a run of adjacent slices, e.g. ab"c d"'e' is three parts
+typedef struct _word
+{
+	WordPart *parts;
+	WordPart *last_part;
+	size_t len; // sum of part lengths, so quote removal allocates exactly once
+	struct _word *next;
+} Word;
+
+typedef struct _redir
+{
+	int type;
+	Word *target;
+	Word *body; // of a here-document, one part per line
+	struct _redir *next;
+} Redir;
+
+// One stage of a pipeline
+typedef struct _command
+{
+	Word *words;
+	Word *last_word;
+	int nwords;
+	Word *assigns; // NAME=value words in front of the command
+	Word *last_assign;
+	int nassigns;
+	Redir *redirs;
+	Redir *last_redir;
+	struct _command *next;
+} Command;
+
+// The pipelines of one line form a list, joined by ; & && ||
+typedef struct _pipeline
+{
+	Command *commands;
+	Command *last_command;
+	int ncommands;
+	int background;
+	int timed; // prefixed with the "time" keyword
+	int connector;
+	size_t start; // its text in the command line, for "jobs"
+	size_t end;
+	struct _pipeline *next;
+} Pipeline;
+
+#endif
@@ -0,0 +1,136 @@
+// parse_bench.c: Throughput and allocations of parse() on a fixed corpus
+// Usage: parse-bench [megabytes]
+// Every line of the corpus is parsed into a fresh job, like the REPL does,
+// until about that many megabytes have gone through parse(). Lines of the same
+// kind come in several sizes; bytes_per_sec staying flat across them is what
+// shows the parser's cost grows linearly with the input.
+// The target is linked with --wrap for malloc, calloc and realloc, so every
+// allocation made by parse.c, jobs.c and arena.c goes through a counter here.
+
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../parse.h"
+
+// normally main.c's, set by parse() on a syntax error
+int error_parsing = 0;
+
+static unsigned long allocations = 0;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t nmemb, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+void *__wrap_malloc(size_t size)
+{
+	allocations++;
+	return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t nmemb, size_t size)
+{
+	allocations++;
+	return __real_calloc(nmemb, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+	allocations++;
+	return __real_realloc(ptr, size);
+}
+
+// Kinds of line; a line is built by repeating its piece up to the wanted size
+typedef struct _corpus
+{
+	const char *name;
+	const char *head;  // start of the line
+	const char *piece; // repeated after it, NULL for a fixed line
+	size_t size;	   // bytes to aim for
+} Corpus;
+
+static const Corpus corpora[] = {
+    {"short", "ls -l /tmp | wc -l", NULL, 0},
+    {"redirect", "sort -k2 <input.txt >>output.txt", NULL, 0},
+    {"redirect-pipe", "cat <in.txt", " | cat", 4096},
+    {"quote", "echo", " 'single q' \"double q\" mi'x'\"ed\"", 4096},
+    {"quote", "echo", " 'single q' \"double q\" mi'x'\"ed\"", 256 << 10},
+    {"pipe", "echo x", " | tr a b", 4096},
+    {"pipe", "echo x", " | tr a b", 256 << 10},
+    {"word", "echo ", "a", 1 << 10},
+    {"word", "echo ", "a", 64 << 10},
+    {"word", "echo ", "a", 1 << 20},
+};
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// build the line of a corpus, ending in '\n' as the reader hands it over
+static char *build_line(const Corpus *corpus, size_t *len)
+{
+	size_t head = strlen(corpus->head);
+	size_t piece = corpus->piece != NULL ? strlen(corpus->piece) : 0;
+	size_t cap = head + corpus->size + piece + 2;
+	char *line = malloc(cap);
+	memcpy(line, corpus->head, head);
+	*len = head;
+	while (piece > 0 && *len < corpus->size)
+	{
+		memcpy(line + *len, corpus->piece, piece);
+		*len += piece;
+	}
+	line[(*len)++] = '\n';
+	line[*len] = '\0';
+	return line;
+}
+
+// parse one line into a new job; 0 if it parsed into a complete command
+static int parse_line(const char *line, size_t len)
+{
+	Job *job = create_job();
+	int status = parse(line, len, job);
+	free_job(job);
+	return status;
+}
+
+static void run(const Corpus *corpus, double megabytes)
+{
+	size_t len;
+	char *line = build_line(corpus, &len);
+	if (parse_line(line, len) != 0 || error_parsing)
+	{
+		fprintf(stderr, "parse-bench: %s: line does not parse\n", corpus->name);
+		exit(1);
+	}
+	long lines = megabytes * (1 << 20) / len;
+	if (lines < 16)
+		lines = 16;
+
+	allocations = 0;
+	double start = now();
+	for (long i = 0; i < lines; i++)
+		parse_line(line, len);
+	double elapsed = now() - start;
+	printf("corpus=%s line_bytes=%zu lines=%ld seconds=%.3f bytes_per_sec=%.0f lines_per_sec=%.0f "
+	       "allocs_per_line=%.2f\n",
+	       corpus->name, len, lines, elapsed, lines * len / elapsed, lines / elapsed,
+	       (double)allocations / lines);
+	free(line);
+}
+
+int main(int argc, char *argv[])
+{
+	double megabytes = argc > 1 ? atof(argv[1]) : 64;
+	setvbuf(stdout, NULL, _IOLBF, 0);
+
+	for (size_t i = 0; i < sizeof(corpora) / sizeof(corpora[0]); i++)
+		run(&corpora[i], megabytes);
+	return 0;
+}
@@ -0,0 +1,311 @@
+// shell_bench.c: Throughput and latency of mumsh on fixed workloads
+// Usage: shell-bench [mumsh] [scale] [setup]
+// Each workload runs in a fresh mumsh reading commands from a pipe. Every
+// command is followed by "echo" of a marker, and its latency is the time
+// from writing the line to reading the marker back. One JSON object per
+// workload is printed, so runs of two commits can be diffed. The setup line,
+// e.g. "set pipebuf=1M", is run first in every shell.
+
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#endif
+#ifndef _DEFAULT_SOURCE
+#define _DEFAULT_SOURCE
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#define MARKER "@bench@\n"
+#define MAX_LINE 65536
+
+typedef struct _shell
+{
+	pid_t pid;
+	int in;	 // commands to mumsh
+	int out; // its stdout
+	int match; // bytes of MARKER seen so far
+} Shell;
+
+// Command i of a workload is written to line
+typedef void (*Generator)(int i, char *line, size_t size);
+
+typedef struct _workload
+{
+	const char *name;
+	int count; // commands at scale 1
+	Generator generate;
+} Workload;
+
+static char dir[] = "/tmp/shell-bench-XXXXXX";
+static char *quoted_line = NULL;
+static const char *setup = ":";
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void shell_start(Shell *sh, const char *mumsh)
+{
+	int in[2], out[2];
+	if (pipe(in) < 0 || pipe(out) < 0)
+	{
+		perror("shell-bench: pipe");
+		exit(1);
+	}
+	sh->pid = fork();
+	if (sh->pid < 0)
+	{
+		perror("shell-bench: fork");
+		exit(1);
+	}
+	if (sh->pid == 0)
+	{
+		dup2(in[0], STDIN_FILENO);
+		dup2(out[1], STDOUT_FILENO);
+		close(in[0]);
+		close(in[1]);
+		close(out[0]);
+		close(out[1]);
+		if (chdir(dir) < 0)
+			_exit(127);
+		execl(mumsh, mumsh, (char *)NULL);
+		_exit(127);
+	}
+	close(in[0]);
+	close(out[1]);
+	sh->in = in[1];
+	sh->out = out[0];
+	sh->match = 0;
+}
+
+static void shell_stop(Shell *sh)
+{
+	close(sh->in);
+	// drain until mumsh exits
+	char buf[4096];
+	while (read(sh->out, buf, sizeof(buf)) > 0)
+		;
+	close(sh->out);
+	waitpid(sh->pid, NULL, 0);
+}
+
+/**
+ * Run one command and wait for the marker after it.
+ * @return latency in seconds
+ */
+static double shell_run(Shell *sh, const char *cmd)
+{
+	static char line[MAX_LINE + sizeof("\necho " MARKER)];
+	size_t len = strlen(cmd);
+	memcpy(line, cmd, len);
+	memcpy(line + len, "\necho " MARKER, sizeof("\necho " MARKER) - 1);
+	len += sizeof("\necho " MARKER) - 1;
+
+	double start = now();
+	for (size_t done = 0; done < len;)
+	{
+		ssize_t n = write(sh->in, line + done, len - done);
+		if (n < 0)
+		{
+			perror("shell-bench: write");
+			exit(1);
+		}
+		done += n;
+	}
+	char buf[4096];
+	while (1)
+	{
+		ssize_t n = read(sh->out, buf, sizeof(buf));
+		if (n <= 0)
+		{
+			fprintf(stderr, "shell-bench: mumsh exited while running: %s\n", cmd);
+			exit(1);
+		}
+		for (ssize_t i = 0; i < n; i++)
+		{
+			if (buf[i] == MARKER[sh->match])
+				sh->match++;
+			else
+				sh->match = buf[i] == MARKER[0];
+			if (sh->match == sizeof(MARKER) - 1)
+			{
+				sh->match = 0;
+				return now() - start;
+			}
+		}
+	}
+}
+
+static void gen_external(int i, char *line, size_t size)
+{
+	snprintf(line, size, "/bin/true");
+}
+
+static void gen_builtin(int i, char *line, size_t size)
+{
+	static const char *const lines[] = {"echo builtin line > /dev/null", "test 1 -eq 1", ":"};
+	snprintf(line, size, "%s", lines[i % 3]);
+}
+
+static void gen_pipeline(int depth, char *line, size_t size)
+{
+	size_t len = snprintf(line, size, "echo x");
+	for (int i = 1; i < depth && len + 16 < size; i++)
+		len += snprintf(line + len, size - len, " | cat");
+	snprintf(line + len, size - len, " > /dev/null");
+}
+
+static void gen_pipeline_2(int i, char *line, size_t size)
+{
+	gen_pipeline(2, line, size);
+}
+
+static void gen_pipeline_10(int i, char *line, size_t size)
+{
+	gen_pipeline(10, line, size);
+}
+
+static void gen_pipeline_50(int i, char *line, size_t size)
+{
+	gen_pipeline(50, line, size);
+}
+
+static void gen_pipeline_200(int i, char *line, size_t size)
+{
+	gen_pipeline(200, line, size);
+}
+
+static void gen_pipeline_bulk(int i, char *line, size_t size)
+{
+	snprintf(line, size, "tr a b < bulk | tr b c | wc -c > /dev/null");
+}
+
+static void gen_redirection(int i, char *line, size_t size)
+{
+	if (i % 2)
+		snprintf(line, size, "cat < input > output%d", i % 8);
+	else
+		snprintf(line, size, "echo line %d >> log", i);
+}
+
+static void gen_quoted(int i, char *line, size_t size)
+{
+	snprintf(line, size, "%s", quoted_line);
+}
+
+static void gen_background(int i, char *line, size_t size)
+{
+	snprintf(line, size, "sleep 0.05 &");
+}
+
+static const Workload workloads[] = {
+    {"external", 2000, gen_external},
+    {"builtin", 5000, gen_builtin},
+    {"pipeline-2", 500, gen_pipeline_2},
+    {"pipeline-10", 200, gen_pipeline_10},
+    {"pipeline-50", 50, gen_pipeline_50},
+    {"pipeline-200", 20, gen_pipeline_200},
+    {"pipeline-bulk", 20, gen_pipeline_bulk},
+    {"redirection", 2000, gen_redirection},
+    {"quoted", 2000, gen_quoted},
+    {"background", 500, gen_background},
+};
+
+static int compare(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+	return (x > y) - (x < y);
+}
+
+static void run(const Workload *workload, const char *mumsh, double scale)
+{
+	int count = workload->count * scale;
+	if (count < 1)
+		count = 1;
+	double *latency = malloc(sizeof(double) * count);
+	char *line = malloc(MAX_LINE);
+	Shell sh;
+	shell_start(&sh, mumsh);
+	// the first command pays for starting the shell
+	shell_run(&sh, setup);
+
+	double start = now();
+	for (int i = 0; i < count; i++)
+	{
+		workload->generate(i, line, MAX_LINE);
+		latency[i] = shell_run(&sh, line);
+	}
+	double elapsed = now() - start;
+	shell_stop(&sh);
+
+	qsort(latency, count, sizeof(double), compare);
+	printf("{\"workload\":\"%s\",\"commands\":%d,\"seconds\":%.3f,\"cmds_per_sec\":%.0f,"
+	       "\"p50_us\":%.0f,\"p90_us\":%.0f,\"p99_us\":%.0f}\n",
+	       workload->name, count, elapsed, count / elapsed, latency[count * 50 / 100] * 1e6,
+	       latency[count * 90 / 100] * 1e6, latency[count * 99 / 100] * 1e6);
+	free(latency);
+	free(line);
+}
+
+int main(int argc, char *argv[])
+{
+	const char *mumsh = argc > 1 ? argv[1] : "./mumsh";
+	double scale = argc > 2 ? atof(argv[2]) : 1;
+	if (argc > 3 && argv[3][0] != '\0')
+		setup = argv[3];
+	setvbuf(stdout, NULL, _IOLBF, 0);
+	signal(SIGPIPE, SIG_IGN);
+
+	// mumsh runs inside a scratch directory, so the path must work from there
+	char *path = realpath(mumsh, NULL);
+	if (path == NULL || access(path, X_OK) < 0)
+	{
+		fprintf(stderr, "shell-bench: %s: %s\n", mumsh, strerror(errno));
+		return 1;
+	}
+	if (mkdtemp(dir) == NULL)
+	{
+		perror("shell-bench: mkdtemp");
+		return 1;
+	}
+	char input[sizeof(dir) + 16];
+	snprintf(input, sizeof(input), "%s/input", dir);
+	FILE *file = fopen(input, "w");
+	for (int i = 0; file != NULL && i < 256; i++)
+		fprintf(file, "line %d of the input of the redirection workload\n", i);
+	if (file != NULL)
+		fclose(file);
+	// 16 MB for the bulk pipeline, where the capacity of the pipes shows
+	snprintf(input, sizeof(input), "%s/bulk", dir);
+	file = fopen(input, "w");
+	for (int i = 0; file != NULL && i < (16 << 20) / 64; i++)
+		fprintf(file, "%063d\n", i);
+	if (file != NULL)
+		fclose(file);
+
+	// a 4 KB line of every kind of quoting
+	quoted_line = malloc(MAX_LINE);
+	size_t len = snprintf(quoted_line, MAX_LINE, "echo");
+	for (int i = 0; len < 4096; i++)
+		len += snprintf(quoted_line + len, MAX_LINE - len, " 'single %d' \"double %d\" mix'ed'\"%d\"", i, i, i);
+	snprintf(quoted_line + len, MAX_LINE - len, " > /dev/null");
+
+	for (size_t i = 0; i < sizeof(workloads) / sizeof(workloads[0]); i++)
+		run(&workloads[i], path, scale);
+
+	// scratch files
+	char cmd[sizeof(dir) + 16];
+	snprintf(cmd, sizeof(cmd), "rm -rf %s", dir);
+	free(quoted_line);
+	free(path);
+	return system(cmd) != 0;
+}
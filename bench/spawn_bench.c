@@ -0,0 +1,67 @@
+// spawn_bench.c: Compare spawns per second of the spawn.c backends
+// Usage: spawn-bench [spawns] [rss_mb]
+// Every backend is measured twice: with the bench's own small footprint, and
+// after touching rss_mb of heap, which is what makes fork() slow in a big shell.
+
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "../spawn.h"
+
+extern char **environ;
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void run(int backend, int spawns, int rss_mb, int devnull)
+{
+	char *argv[] = {"true", NULL};
+	double start = now();
+	for (int i = 0; i < spawns; i++)
+	{
+		int error = 0;
+		pid_t pid = spawn_command(backend, NULL, argv, environ, STDIN_FILENO, devnull, -1, &error);
+		if (pid < 0)
+		{
+			fprintf(stderr, "spawn-bench: %s: %s\n", spawn_backend_name(backend), strerror(error));
+			exit(1);
+		}
+		waitpid(pid, NULL, 0);
+	}
+	double elapsed = now() - start;
+	printf("backend=%s rss_mb=%d spawns=%d seconds=%.3f spawns_per_sec=%.0f\n", spawn_backend_name(backend),
+	       rss_mb, spawns, elapsed, spawns / elapsed);
+}
+
+int main(int argc, char *argv[])
+{
+	int spawns = argc > 1 ? atoi(argv[1]) : 2000;
+	int rss_mb = argc > 2 ? atoi(argv[2]) : 256;
+	int devnull = open("/dev/null", O_WRONLY | O_CLOEXEC);
+	setvbuf(stdout, NULL, _IOLBF, 0);
+
+	for (int backend = SPAWN_FORK; backend <= SPAWN_POSIX; backend++)
+		run(backend, spawns, 0, devnull);
+
+	// grow the resident set; every page must be touched to be mapped
+	size_t size = (size_t)rss_mb << 20;
+	char *ballast = malloc(size);
+	if (ballast == NULL)
+		return 1;
+	memset(ballast, 1, size);
+	for (int backend = SPAWN_FORK; backend <= SPAWN_POSIX; backend++)
+		run(backend, spawns, rss_mb, devnull);
+	free(ballast);
+	return 0;
+}
@@ -0,0 +1,180 @@
+// builtin.c: Table of commands run by the shell itself
+// Every builtin takes argv and the job list and returns an exit status. It
+// may run in the shell process or in a forked child; either way it reads
+// fd 0 and writes fd 1, which execute() points at the right places.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "builtin.h"
+#include "execute.h"
+#include "cd.h"
+#include "pwd.h"
+#include "hash.h"
+#include "echo.h"
+#include "test.h"
+#include "cat.h"
+#include "option.h"
+#include "parallel.h"
+#include "var.h"
+#include "history.h"
+#include "report.h"
+
+int shell_exiting = 0;
+
+static int builtin_cd(char **argv, JobTable *jobs)
+{
+	int error_code = 0;
+	if (argv[1] == 0)
+	{
+		// cd to $HOME
+		// if $HOME is not set, cd to /
+		const char *home = var_get("HOME");
+		if (home == NULL || do_cd(home) < 0)
+			do_cd("/");
+		return 0;
+	}
+	// implementation of "cd -" is in do_cd()
+	error_code = do_cd(argv[1]);
+	if (error_code < 0)
+	{
+		if (errno == ENOENT)
+			report("%s: No such file or directory\n", argv[1]);
+		else if (errno == EACCES)
+			report("%s: Permission denied\n", argv[1]);
+		else
+			report("%s: %s\n", argv[1], strerror(errno));
+		return 1;
+	}
+	return 0;
+}
+
+static int builtin_pwd(char **argv, JobTable *jobs)
+{
+	do_pwd();
+	return 0;
+}
+
+static int builtin_jobs(char **argv, JobTable *jobs)
+{
+	do_jobs(jobs);
+	return 0;
+}
+
+static int builtin_hash(char **argv, JobTable *jobs)
+{
+	return do_hash(argv);
+}
+
+static int builtin_exit(char **argv, JobTable *jobs)
+{
+	shell_exiting = 1;
+	if (argv[1] != 0)
+		return atoi(argv[1]) & 0xff;
+	return last_status;
+}
+
+static int builtin_echo(char **argv, JobTable *jobs)
+{
+	return do_echo(argv);
+}
+
+static int builtin_parallel(char **argv, JobTable *jobs)
+{
+	return do_parallel(argv, jobs);
+}
+
+static int builtin_printf(char **argv, JobTable *jobs)
+{
+	return do_printf(argv);
+}
+
+static int builtin_cat(char **argv, JobTable *jobs)
+{
+	return do_cat(argv);
+}
+
+static int builtin_set(char **argv, JobTable *jobs)
+{
+	return do_set(argv);
+}
+
+static int builtin_export(char **argv, JobTable *jobs)
+{
+	return do_export(argv);
+}
+
+static int builtin_unset(char **argv, JobTable *jobs)
+{
+	return do_unset(argv);
+}
+
+static int builtin_history(char **argv, JobTable *jobs)
+{
+	return do_history(argv);
+}
+
+static int builtin_test(char **argv, JobTable *jobs)
+{
+	return do_test(argv);
+}
+
+// ":" and "true"
+static int builtin_true(char **argv, JobTable *jobs)
+{
+	return 0;
+}
+
+static int builtin_false(char **argv, JobTable *jobs)
+{
+	return 1;
+}
+
+static const Builtin builtins[] = {
+    {":", builtin_true, NULL, 0},
+    {"[", builtin_test, NULL, 0},
+    {"cat", builtin_cat, cat_takes, 0},
+    {"cd", builtin_cd, NULL, 1},
+    {"echo", builtin_echo, NULL, 0},
+    {"exit", builtin_exit, NULL, 1},
+    {"export", builtin_export, NULL, 1},
+    {"false", builtin_false, NULL, 0},
+    {"hash", builtin_hash, NULL, 1},
+    {"history", builtin_history, NULL, 0},
+    {"jobs", builtin_jobs, NULL, 0},
+    {"parallel", builtin_parallel, NULL, 0},
+    {"printf", builtin_printf, NULL, 0},
+    {"pwd", builtin_pwd, NULL, 0},
+    {"set", builtin_set, NULL, 1},
+    {"test", builtin_test, NULL, 0},
+    {"true", builtin_true, NULL, 0},
+    {"unset", builtin_unset, NULL, 1},
+};
+
+/**
+ * Look up the builtin that runs a task.
+ * @param task the task, with argv and its fds set up
+ * @return the builtin, or NULL if the task runs an external command
+ */
+const Builtin *find_builtin(Task *task)
+{
+	for (size_t i = 0; i < sizeof(builtins) / sizeof(builtins[0]); i++)
+		if (strcmp(builtins[i].name, task->argv[0]) == 0)
+			return builtins[i].takes == NULL || builtins[i].takes(task) ? &builtins[i] : NULL;
+	return NULL;
+}
+
+/**
+ * Tell whether a command of that name would change the shell itself when
+ * run in it, as cd and exit do.
+ * @param name the command name
+ * @return 1 if it is such a builtin
+ */
+int builtin_changes_shell(const char *name)
+{
+	for (size_t i = 0; i < sizeof(builtins) / sizeof(builtins[0]); i++)
+		if (strcmp(builtins[i].name, name) == 0)
+			return builtins[i].changes_shell;
+	return 0;
+}
@@ -0,0 +1,26 @@
+// builtin.h: Table of commands run by the shell itself
+
+#ifndef BUILTIN_H
+#define BUILTIN_H
+
+#include "jobs.h"
+
+typedef int (*BuiltinFunc)(char **argv, JobTable *jobs);
+// whether the builtin runs a task; when it does not, the task goes to $PATH
+typedef int (*BuiltinTakes)(Task *task);
+
+typedef struct _builtin
+{
+	const char *name;
+	BuiltinFunc func;
+	BuiltinTakes takes; // NULL if it runs every task named after it
+	int changes_shell;  // state of the shell, which $(...) must not touch
+} Builtin;
+
+// set by "exit"; execute() then tells main() to leave the REPL
+extern int shell_exiting;
+
+const Builtin *find_builtin(Task *task);
+int builtin_changes_shell(const char *name);
+
+#endif
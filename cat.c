@@ -0,0 +1,274 @@
+// cat.c: The "cat" builtin
+// Data is moved by the kernel whenever the two ends allow it:
+// copy_file_range() between regular files, splice() when either end is a
+// pipe, sendfile() from a regular file to anything else. Whatever is left
+// (a terminal, a socket on both ends) goes through a read()/write() loop.
+// All of them use and advance the file offsets, so a method that gives up
+// half way can hand over to the next one. In the shell process ^C is blocked
+// and left for the signalfd, so the copy moves at most CHUNK_SIZE at a time
+// and looks for it in between. Inputs that may keep it waiting for good, and
+// terminals, which ^C comes from, go to the cat in $PATH.
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+#include "cat.h"
+#include "report.h"
+
+// most a kernel-side copy moves before we look for ^C again
+#define CHUNK_SIZE (1 << 20)
+#define BUFFER_SIZE (128 << 10)
+
+// the method does not work for these two fds, try the next one
+static int unsupported(int error)
+{
+	return error == EINVAL || error == EXDEV || error == ENOSYS || error == EOPNOTSUPP || error == EBADF;
+}
+
+// errors that are the output's fault; cat stops at the first of them
+static int write_error(int error)
+{
+	return error == EPIPE || error == ENOSPC || error == EDQUOT || error == EFBIG;
+}
+
+// whether ^C came while we copy; it is taken, so it does not also drop the next line
+static int interrupted(void)
+{
+	sigset_t pending;
+	if (sigpending(&pending) < 0 || !sigismember(&pending, SIGINT))
+		return 0;
+	sigset_t sigint;
+	sigemptyset(&sigint);
+	sigaddset(&sigint, SIGINT);
+	struct timespec now = {0, 0};
+	sigtimedwait(&sigint, NULL, &now);
+	return 1;
+}
+
+/**
+ * Move data with a kernel-side method until the end of the input.
+ * @param method 'c' copy_file_range, 's' splice, 'f' sendfile
+ * @return 0 at the end of input, 1 if the method does not apply, -1 on error,
+ * -2 if ^C stopped it
+ */
+static int copy_kernel(int method, int in, int out)
+{
+	while (1)
+	{
+		if (interrupted())
+			return -2;
+		ssize_t n;
+		if (method == 'c')
+			n = copy_file_range(in, NULL, out, NULL, CHUNK_SIZE, 0);
+		else if (method == 's')
+			n = splice(in, NULL, out, NULL, CHUNK_SIZE, SPLICE_F_MOVE | SPLICE_F_MORE);
+		else
+			n = sendfile(out, in, NULL, CHUNK_SIZE);
+		if (n == 0)
+			return 0;
+		if (n > 0)
+			continue;
+		if (errno == EINTR)
+			continue;
+		return unsupported(errno) ? 1 : -1;
+	}
+}
+
+// the plain way, through a buffer
+static int copy_buffer(int in, int out)
+{
+	static char *buffer = NULL;
+	if (buffer == NULL)
+		buffer = malloc(BUFFER_SIZE);
+	while (1)
+	{
+		if (interrupted())
+			return -2;
+		ssize_t n = read(in, buffer, BUFFER_SIZE);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return n;
+		for (ssize_t done = 0; done < n;)
+		{
+			ssize_t written = write(out, buffer + done, n - done);
+			if (written < 0 && errno == EINTR)
+				continue;
+			if (written < 0)
+				return -1;
+			done += written;
+		}
+	}
+}
+
+/**
+ * Copy everything from in to out, picking the cheapest method the two allow.
+ * @return 0 on success, -1 on error with errno set, -2 if ^C stopped it
+ */
+static int copy_fd(int in, int out, const struct stat *ist, const struct stat *ost)
+{
+	int status = 1;
+	if (S_ISREG(ist->st_mode) && S_ISREG(ost->st_mode))
+		status = copy_kernel('c', in, out);
+	if (status > 0 && (S_ISFIFO(ist->st_mode) || S_ISFIFO(ost->st_mode)))
+		status = copy_kernel('s', in, out);
+	if (status > 0 && S_ISREG(ist->st_mode))
+		status = copy_kernel('f', in, out);
+	if (status > 0)
+		status = copy_buffer(in, out);
+	return status;
+}
+
+/**
+ * Copy everything from one fd to another, the way cat does.
+ * @param in where to read, from its current offset
+ * @param out where to write
+ * @return 0 on success, -1 on error with errno set, -2 if ^C stopped it
+ */
+int cat_fd(int in, int out)
+{
+	struct stat ist, ost;
+	if (fstat(in, &ist) < 0 || fstat(out, &ost) < 0)
+		return -1;
+	return copy_fd(in, out, &ist, &ost);
+}
+
+/**
+ * Tell whether the builtin runs this task. Options other than -u are left to
+ * the cat found in $PATH, and so is any input that can block a read() for
+ * good: a terminal, a device, a named fifo or a socket. The shell blocks ^C
+ * for itself, and a cat in the shell process stuck there could not be stopped.
+ * Stdin may also be a pipe, which ends when the stages before it do. Output
+ * to a terminal goes to that cat as well: a write there can take long, and
+ * only a process of its own stops in the middle of one on ^C.
+ * @param task the task, with its argv and srcfd set up
+ * @return 1 if do_cat() should run it
+ */
+int cat_takes(Task *task)
+{
+	int files = 0;
+	int reads_stdin = 0;
+	int options = 1;
+	struct stat st;
+	if (isatty(task->dstfd))
+		return 0;
+	for (char **arg = task->argv + 1; *arg != NULL; arg++)
+	{
+		if (options && strcmp(*arg, "--") == 0)
+			options = 0;
+		else if (options && strcmp(*arg, "-u") == 0)
+			continue;
+		else if (options && (*arg)[0] == '-' && (*arg)[1] != '\0')
+			return 0;
+		else if (strcmp(*arg, "-") == 0)
+		{
+			files++;
+			reads_stdin = 1;
+		}
+		else
+		{
+			files++;
+			// one that is missing only makes an error message
+			if (stat(*arg, &st) == 0 && !S_ISREG(st.st_mode) && !S_ISDIR(st.st_mode))
+				return 0;
+		}
+	}
+	if (files > 0 && !reads_stdin)
+		return 1;
+	return fstat(task->srcfd, &st) == 0 && (S_ISREG(st.st_mode) || S_ISFIFO(st.st_mode)) && !isatty(task->srcfd);
+}
+
+/**
+ * cat: copy each file, or stdin for "-" or no file at all, to stdout.
+ * -u is accepted and changes nothing, output is never buffered.
+ * @param argv the arguments
+ * @return 0 on success, 1 if any file could not be copied
+ */
+int do_cat(char **argv)
+{
+	struct stat ost;
+	if (fstat(STDOUT_FILENO, &ost) < 0)
+	{
+		report("cat: write error: %s\n", strerror(errno));
+		return 1;
+	}
+	// operands, leaving out -u and the first "--"
+	int argc = 0;
+	while (argv[argc] != NULL)
+		argc++;
+	char **files = malloc(sizeof(char *) * (argc + 1));
+	int nfiles = 0;
+	int options = 1;
+	for (int i = 1; i < argc; i++)
+	{
+		if (options && strcmp(argv[i], "--") == 0)
+			options = 0;
+		else if (!options || strcmp(argv[i], "-u") != 0)
+			files[nfiles++] = argv[i];
+	}
+	if (nfiles == 0)
+		files[nfiles++] = "-";
+	files[nfiles] = NULL;
+
+	int status = 0;
+	int copied;
+	for (int i = 0; i < nfiles; i++)
+	{
+		int in = STDIN_FILENO;
+		if (strcmp(files[i], "-") != 0)
+			in = open(files[i], O_RDONLY | O_CLOEXEC);
+		struct stat ist;
+		if (in < 0 || fstat(in, &ist) < 0)
+		{
+			report("cat: %s: %s\n", files[i], strerror(errno));
+			status = 1;
+			continue;
+		}
+		if (S_ISDIR(ist.st_mode))
+		{
+			report("cat: %s: Is a directory\n", files[i]);
+			status = 1;
+		}
+		else if (S_ISREG(ist.st_mode) && S_ISREG(ost.st_mode) && ist.st_dev == ost.st_dev &&
+			 ist.st_ino == ost.st_ino)
+		{
+			// "cat a >> a" would never reach the end of a
+			report("cat: %s: input file is output file\n", files[i]);
+			status = 1;
+		}
+		else if ((copied = copy_fd(in, STDOUT_FILENO, &ist, &ost)) == -2)
+		{
+			status = 128 + SIGINT;
+			if (in != STDIN_FILENO)
+				close(in);
+			break;
+		}
+		else if (copied < 0)
+		{
+			int error = errno;
+			status = 1;
+			if (write_error(error))
+			{
+				report("cat: write error: %s\n", strerror(error));
+				if (in != STDIN_FILENO)
+					close(in);
+				break;
+			}
+			report("cat: %s: %s\n", files[i], strerror(error));
+		}
+		if (in != STDIN_FILENO)
+			close(in);
+	}
+	free(files);
+	return status;
+}
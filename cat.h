@@ -0,0 +1,12 @@
+// cat.h: The "cat" builtin
+
+#ifndef CAT_H
+#define CAT_H
+
+#include "jobs.h"
+
+int cat_takes(Task *task);
+int cat_fd(int in, int out);
+int do_cat(char **argv);
+
+#endif
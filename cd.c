@@ -4,8 +4,9 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include "cd.h"
+#include "var.h"
 
-int do_cd(char *cmdline)
+int do_cd(const char *cmdline)
 {
 	// implement "cd -"
 	// don't handle errors (it's guaranteed to be correct)
@@ -14,11 +15,11 @@ int do_cd(char *cmdline)
 		// save current working directory
 		char *cwd = getcwd(NULL, 0);
 		// cd to OLDPWD
-		chdir(getenv("OLDPWD"));
+		chdir(var_get("OLDPWD"));
 		// print OLDPWD
-		printf("%s\n", getenv("OLDPWD"));
+		printf("%s\n", var_get("OLDPWD"));
 		// update OLDPWD
-		setenv("OLDPWD", cwd, 1);
+		var_set("OLDPWD", cwd, 1);
 		// free memory
 		free(cwd);
 		return 0;
@@ -27,7 +28,7 @@ int do_cd(char *cmdline)
 	int error_code = chdir(cmdline);
 	if (error_code == 0)
 		// update OLDPWD
-		setenv("OLDPWD", cwd, 1);
+		var_set("OLDPWD", cwd, 1);
 	free(cwd);
 	return error_code;
 }
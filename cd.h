@@ -4,6 +4,6 @@
 #include <string.h>
 #include <unistd.h>
 
-int do_cd(char* cmdline);
+int do_cd(const char* cmdline);
 
 #endif
@@ -0,0 +1,413 @@
+// echo.c: The "echo" and "printf" builtins
+// Output is collected in memory and handed to fd 1 with a single write(),
+// so a reader on the other end of a pipe gets the whole line at once.
+
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <ctype.h>
+#include <limits.h>
+#include <errno.h>
+#include <unistd.h>
+#include "echo.h"
+#include "report.h"
+
+/**
+ * Write what was collected in a memory stream to fd 1, and free it.
+ * @return 0 on success, 1 on a write error
+ */
+static int flush_out(FILE *out, char **buf, size_t *size)
+{
+	int status = fclose(out) != 0;
+	size_t done = 0;
+	while (!status && done < *size)
+	{
+		ssize_t n = write(STDOUT_FILENO, *buf + done, *size - done);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0)
+			status = 1;
+		else
+			done += n;
+	}
+	free(*buf);
+	return status;
+}
+
+/**
+ * Expand the backslash escape at s.
+ * @param out where the character goes
+ * @param s points at the backslash
+ * @param zero_octal 1 if \0NNN takes three digits after the 0 (echo, %b)
+ * @param stop set to 1 on \c, after which nothing more is printed
+ * @return number of characters consumed
+ */
+static size_t put_escape(FILE *out, const char *s, int zero_octal, int *stop)
+{
+	size_t i = 2;
+	int value = 0;
+	switch (s[1])
+	{
+	case 'a':
+		fputc('\a', out);
+		break;
+	case 'b':
+		fputc('\b', out);
+		break;
+	case 'e':
+		fputc('\033', out);
+		break;
+	case 'f':
+		fputc('\f', out);
+		break;
+	case 'n':
+		fputc('\n', out);
+		break;
+	case 'r':
+		fputc('\r', out);
+		break;
+	case 't':
+		fputc('\t', out);
+		break;
+	case 'v':
+		fputc('\v', out);
+		break;
+	case '\\':
+		fputc('\\', out);
+		break;
+	case 'c':
+		*stop = 1;
+		break;
+	case 'x':
+		for (; i < 4 && isxdigit((unsigned char)s[i]); i++)
+			value = value * 16 + (isdigit((unsigned char)s[i]) ? s[i] - '0' : tolower((unsigned char)s[i]) - 'a' + 10);
+		if (i == 2)
+			fputs("\\x", out);
+		else
+			fputc(value, out);
+		break;
+	case '0':
+	case '1':
+	case '2':
+	case '3':
+	case '4':
+	case '5':
+	case '6':
+	case '7':
+	{
+		i = zero_octal && s[1] == '0' ? 2 : 1;
+		size_t end = i + 3;
+		for (; i < end && s[i] >= '0' && s[i] <= '7'; i++)
+			value = value * 8 + s[i] - '0';
+		fputc(value, out);
+		break;
+	}
+	case '\0':
+		fputc('\\', out);
+		i = 1;
+		break;
+	default:
+		// not an escape, keep it as it is
+		fputc('\\', out);
+		fputc(s[1], out);
+		break;
+	}
+	return i;
+}
+
+/**
+ * echo, as in coreutils: -n drops the newline, -e enables escapes and -E
+ * disables them. An argument is only taken as options if it consists of
+ * these letters alone.
+ * @param argv the arguments
+ * @return 0 on success, 1 on a write error
+ */
+int do_echo(char **argv)
+{
+	int newline = 1;
+	int escapes = 0;
+	int i = 1;
+	for (; argv[i] != NULL && argv[i][0] == '-' && argv[i][1] != '\0' &&
+	       strspn(argv[i] + 1, "neE") == strlen(argv[i] + 1);
+	     i++)
+		for (char *opt = argv[i] + 1; *opt; opt++)
+		{
+			if (*opt == 'n')
+				newline = 0;
+			else
+				escapes = *opt == 'e';
+		}
+
+	char *buf = NULL;
+	size_t size = 0;
+	FILE *out = open_memstream(&buf, &size);
+	if (out == NULL)
+		return 1;
+	int stop = 0;
+	for (int first = i; argv[i] != NULL && !stop; i++)
+	{
+		if (i > first)
+			fputc(' ', out);
+		if (!escapes)
+		{
+			fputs(argv[i], out);
+			continue;
+		}
+		for (const char *s = argv[i]; *s && !stop;)
+		{
+			if (*s == '\\')
+				s += put_escape(out, s, 1, &stop);
+			else
+				fputc(*s++, out);
+		}
+	}
+	if (newline && !stop)
+		fputc('\n', out);
+	return flush_out(out, &buf, &size);
+}
+
+// take the next argument of printf, or "" when they ran out
+static const char *next_arg(char ***args)
+{
+	if (**args == NULL)
+		return "";
+	return *(*args)++;
+}
+
+// the argument of a numeric conversion; 'c and "c give the code of c
+static intmax_t to_int(const char *arg, int is_unsigned, int *status)
+{
+	if (arg[0] == '\'' || arg[0] == '"')
+		return (unsigned char)arg[1];
+	if (arg[0] == '\0')
+		return 0;
+	char *end;
+	errno = 0;
+	intmax_t value = is_unsigned ? (intmax_t)strtoumax(arg, &end, 0) : strtoimax(arg, &end, 0);
+	if (end == arg || *end != '\0' || errno)
+	{
+		report("printf: %s: invalid number\n", arg);
+		*status = 1;
+	}
+	return value;
+}
+
+static long double to_float(const char *arg, int *status)
+{
+	if (arg[0] == '\'' || arg[0] == '"')
+		return (unsigned char)arg[1];
+	if (arg[0] == '\0')
+		return 0;
+	char *end;
+	errno = 0;
+	long double value = strtold(arg, &end);
+	if (end == arg || *end != '\0' || errno)
+	{
+		report("printf: %s: invalid number\n", arg);
+		*status = 1;
+	}
+	return value;
+}
+
+/**
+ * Read a field width or precision: the digits at *f, or the next argument
+ * for a '*'.
+ * @param what "field width" or "precision", for the error message
+ * @return the value, INT_MIN if it does not fit an int (reported here)
+ */
+static int field_size(const char **f, char ***args, const char *what, int *status)
+{
+	const char *text = *f;
+	size_t len;
+	intmax_t value = 0;
+	if (**f == '*')
+	{
+		text = next_arg(args);
+		len = strlen(text);
+		value = to_int(text, 0, status);
+		(*f)++;
+	}
+	else
+	{
+		for (; isdigit((unsigned char)**f); (*f)++)
+			if (value <= INT_MAX)
+				value = value * 10 + **f - '0';
+		len = *f - text;
+	}
+	if (value > INT_MAX || value < -INT_MAX)
+	{
+		report("printf: %.*s: invalid %s\n", (int)len, text, what);
+		*status = 1;
+		return INT_MIN;
+	}
+	return value;
+}
+
+/**
+ * Handle one conversion of a printf format.
+ * @param out where the output goes
+ * @param f points at the '%'
+ * @param args the arguments left, advanced past those consumed
+ * @param status set to 1 on a bad argument
+ * @param stop set to 1 when printing must end
+ * @return the rest of the format
+ */
+static const char *convert(FILE *out, const char *f, char ***args, int *status, int *stop)
+{
+	// rebuilt as %<flags>*.*<length><conversion> for the C library
+	char spec[16] = "%";
+	size_t n = 1;
+	f++;
+	if (*f == '%')
+	{
+		fputc('%', out);
+		return f + 1;
+	}
+	for (; *f && strchr("-+ #0", *f); f++)
+		if (n < 6)
+			spec[n++] = *f;
+	int precision = -1;
+	int width = field_size(&f, args, "field width", status);
+	if (width != INT_MIN && *f == '.')
+	{
+		f++;
+		precision = field_size(&f, args, "precision", status);
+	}
+	if (width == INT_MIN || precision == INT_MIN)
+	{
+		*stop = 1;
+		return f;
+	}
+	// the argument decides the size, not the format
+	while (*f && strchr("hlLqjzt", *f))
+		f++;
+	spec[n++] = '*';
+	spec[n++] = '.';
+	spec[n++] = '*';
+
+	char conv = *f;
+	switch (conv)
+	{
+	case 'd':
+	case 'i':
+		spec[n++] = 'j';
+		spec[n++] = conv;
+		fprintf(out, spec, width, precision, to_int(next_arg(args), 0, status));
+		break;
+	case 'u':
+	case 'o':
+	case 'x':
+	case 'X':
+		spec[n++] = 'j';
+		spec[n++] = conv;
+		fprintf(out, spec, width, precision, (uintmax_t)to_int(next_arg(args), 1, status));
+		break;
+	case 'e':
+	case 'E':
+	case 'f':
+	case 'F':
+	case 'g':
+	case 'G':
+	case 'a':
+	case 'A':
+		spec[n++] = 'L';
+		spec[n++] = conv;
+		fprintf(out, spec, width, precision, to_float(next_arg(args), status));
+		break;
+	case 'c':
+	{
+		char c[2] = {next_arg(args)[0], '\0'};
+		spec[n++] = 's';
+		fprintf(out, spec, width, -1, c);
+		break;
+	}
+	case 's':
+		spec[n++] = 's';
+		fprintf(out, spec, width, precision, next_arg(args));
+		break;
+	case 'b':
+	{
+		// expand the argument like "echo -e" first
+		char *expanded = NULL;
+		size_t size = 0;
+		FILE *tmp = open_memstream(&expanded, &size);
+		if (tmp == NULL)
+		{
+			*status = 1;
+			*stop = 1;
+			return f + 1;
+		}
+		for (const char *s = next_arg(args); *s && !*stop;)
+		{
+			if (*s == '\\')
+				s += put_escape(tmp, s, 1, stop);
+			else
+				fputc(*s++, tmp);
+		}
+		fclose(tmp);
+		spec[n++] = 's';
+		fprintf(out, spec, width, precision, expanded);
+		free(expanded);
+		break;
+	}
+	case '\0':
+		report("printf: %%: missing format character\n");
+		*status = 1;
+		*stop = 1;
+		return f;
+	default:
+		report("printf: %c: invalid format character\n", conv);
+		*status = 1;
+		*stop = 1;
+		break;
+	}
+	return f + 1;
+}
+
+/**
+ * printf, as in POSIX: the format is reused until all arguments are
+ * consumed, and missing arguments count as "" or 0.
+ * @param argv the arguments, argv[1] being the format
+ * @return 0 on success, 1 if an argument was bad, 2 on usage error
+ */
+int do_printf(char **argv)
+{
+	if (argv[1] == NULL)
+	{
+		report("printf: usage: printf format [arguments]\n");
+		return 2;
+	}
+	char *buf = NULL;
+	size_t size = 0;
+	FILE *out = open_memstream(&buf, &size);
+	if (out == NULL)
+		return 1;
+	char **args = argv + 2;
+	int status = 0;
+	int stop = 0;
+	do
+	{
+		char **start = args;
+		const char *f = argv[1];
+		while (*f && !stop)
+		{
+			if (*f == '\\')
+				f += put_escape(out, f, 0, &stop);
+			else if (*f == '%')
+				f = convert(out, f, &args, &status, &stop);
+			else
+				fputc(*f++, out);
+		}
+		// a format without conversions is printed once
+		if (args == start)
+			break;
+	} while (*args != NULL && !stop);
+	if (flush_out(out, &buf, &size))
+		status = 1;
+	return status;
+}
@@ -0,0 +1,9 @@
+// echo.h: The "echo" and "printf" builtins
+
+#ifndef ECHO_H
+#define ECHO_H
+
+int do_echo(char **argv);
+int do_printf(char **argv);
+
+#endif
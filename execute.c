@@ -1,89 +1,242 @@
 // execute.c: handle actual execution of commands
 // Created by Mack Sept. 18 2022
 
-#ifndef _POSIX_C_SOURCE
-#define _POSIX_C_SOURCE 200112L
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
 #endif
 #include <stdio.h>
 #include <stdlib.h>
 #include <signal.h>
+#include <fcntl.h>
 #include "jobs.h"
 #include "execute.h"
-#include "cd.h"
-#include "pwd.h"
+#include "expand.h"
+#include "builtin.h"
+#include "spawn.h"
+#include "hash.h"
+#include "timing.h"
+#include "trace.h"
+#include "pipebuf.h"
+#include "jobslot.h"
+#include "subst.h"
+#include "var.h"
+#include "report.h"
 
-extern Job *current_job;
+extern int interactive;
+
+// exit status of the last foreground job, what "mumsh script.sh" exits with; $?
+int last_status = 0;
+// exit status of each stage of the last foreground job; ${PIPESTATUS[n]}
+int *pipe_status = NULL;
+int npipe_status = 0;
+
+// a job that ran no pipeline at all has one status
+static void record_status(int status)
+{
+	last_status = status;
+	pipe_status = realloc(pipe_status, sizeof(int));
+	pipe_status[0] = status;
+	npipe_status = 1;
+}
+
+// statuses of every stage of a finished foreground job; the last one is the job's
+static void record_pipeline(Job *job)
+{
+	int n = 0;
+	for (Task *task = job->tasks; task != NULL; task = task->next)
+		n++;
+	pipe_status = realloc(pipe_status, sizeof(int) * n);
+	npipe_status = 0;
+	for (Task *task = job->tasks; task != NULL; task = task->next)
+		pipe_status[npipe_status++] = task->exit_code;
+	last_status = job->last_task->exit_code;
+}
 
 /**
- * execute - execute "only one" command line
- * @param some_job A Job structure, which contains all the tasks
+ * Run a builtin in a forked child, as part of a pipeline or a background job.
+ * @param builtin the builtin
+ * @param curr the task
+ * @param jobs for the sake of do_jobs()
+ * @param pgid process group to join, -1 for none
+ */
+static void builtin_child(const Builtin *builtin, Task *curr, JobTable *jobs, pid_t pgid)
+{
+	// the most important thing upon successful fork is to restore SIGINT, SIGCHLD and SIGTTOU
+	child_reset_signals();
+
+	// if this is the first child (and it's background), set pgid to pid
+	if (pgid >= 0)
+		setpgid(0, pgid);
+	// first do dup2
+	// since invalid tasks are already deleted, we don't need to check
+	dup2(curr->dstfd, STDOUT_FILENO);
+	dup2(curr->srcfd, STDIN_FILENO);
+	// a fork keeps every pipe of the pipeline open, close-on-exec or not; the read end
+	// of our own output would keep a writer like cat from ever seeing EPIPE.
+	// Only where error messages go, in a command substitution, stays, as fd 3.
+	int first_closed = 3;
+	if (report_fd > 2)
+	{
+		dup2(report_fd, 3);
+		report_fd = 3;
+		first_closed = 4;
+	}
+	close_range(first_closed, ~0U, 0);
+	// we are essentially a subshell, so exit with the status of the builtin
+	exit(builtin->func(curr->argv, jobs));
+}
+
+/**
+ * Run a builtin in the shell process. Its fds are swapped in for the
+ * duration of the call and the shell's own are put back afterwards.
+ * @param builtin the builtin
+ * @param curr the task
  * @param jobs for the sake of do_jobs()
- * @return 0 on success, otherwise error
+ * @return exit status of the builtin
  */
-int execute(Job *some_job, Job *jobs)
+static int builtin_in_shell(const Builtin *builtin, Task *curr, JobTable *jobs)
+{
+	int saved_stdin = -1;
+	int saved_stdout = -1;
+	if (curr->srcfd != STDIN_FILENO)
+	{
+		saved_stdin = fcntl(STDIN_FILENO, F_DUPFD_CLOEXEC, 10);
+		dup2(curr->srcfd, STDIN_FILENO);
+		close(curr->srcfd);
+	}
+	if (curr->dstfd != STDOUT_FILENO)
+	{
+		saved_stdout = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 10);
+		dup2(curr->dstfd, STDOUT_FILENO);
+		close(curr->dstfd);
+	}
+
+	int status = builtin->func(curr->argv, jobs);
+
+	// restore stdin and stdout
+	if (saved_stdin >= 0)
+	{
+		dup2(saved_stdin, STDIN_FILENO);
+		close(saved_stdin);
+	}
+	if (saved_stdout >= 0)
+	{
+		dup2(saved_stdout, STDOUT_FILENO);
+		close(saved_stdout);
+	}
+	if (shell_exiting && interactive)
+		printf("exit\n");
+	return status;
+}
+
+/**
+ * Start an external command, looking it up in the hash table first.
+ * Errors are reported here; the task is then left with pid 0.
+ * @param curr the task
+ * @param pgid process group for spawn_command()
+ */
+void start_command(Task *curr, pid_t pgid)
+{
+	// look the command up in the table; a miss costs no process at all
+	int error = 0;
+	char **envp = curr->assigns != NULL ? var_environ_with(curr->assigns, curr->job->arena) : var_environ();
+	const char *path = hash_lookup(curr->argv[0], &error);
+	if (path != NULL)
+		curr->pid = spawn_command(spawn_backend, path, curr->argv, envp, curr->srcfd, curr->dstfd, pgid,
+					  &error);
+	if (path != NULL && curr->pid < 0 && error == ENOENT && path != curr->argv[0])
+	{
+		// the file we remembered is gone, search $PATH again
+		hash_forget(curr->argv[0]);
+		path = hash_lookup(curr->argv[0], &error);
+		if (path != NULL)
+			curr->pid = spawn_command(spawn_backend, path, curr->argv, envp, curr->srcfd, curr->dstfd,
+						  pgid, &error);
+	}
+	if (path == NULL || curr->pid < 0)
+	{
+		curr->pid = 0;
+		if (error == ENOENT)
+			report("%s: command not found\n", curr->argv[0]);
+		else
+			report("%s: %s\n", curr->argv[0], strerror(error));
+		curr->exit_code = error == ENOENT ? 127 : 126;
+	}
+}
+
+// a job that does not start after all: close the files expand_task() opened,
+// and the pipes between its stages if they were made
+static void close_redirections(Job *job)
 {
-	// save stdin and stdout
-	int saved_stdout = dup(STDOUT_FILENO);
-	int saved_stdin = dup(STDIN_FILENO);
+	for (Task *task = job->tasks; task != NULL && task->argv != NULL; task = task->next)
+	{
+		if (task->srcfd > 0)
+			close(task->srcfd);
+		if (task->dstfd > 1)
+			close(task->dstfd);
+	}
+}
 
-	int error_code = 0;
+/**
+ * Run a job that may start now: expand it, wire up its pipes, start its
+ * stages and, in the foreground, wait for them.
+ * @param some_job the job
+ * @param jobs the job table
+ * @return as execute()
+ */
+static int run_job(Job *some_job, JobTable *jobs)
+{
+	// build argv and open redirections of every task
+	TRACE_BEGIN(expand_start);
+	int substs_before = subst_runs;
+	int expanded = 0;
+	for (Task *task = some_job->tasks; task != NULL && expanded == 0; task = task->next)
+		expanded = expand_task(task, some_job->arena, jobs);
+	TRACE_END(expand_start, "expand", some_job->jobid);
 
-	// do nothing if there is no argv[0] in first task (in following tasks, if there's no argv parse() should report error)
-	if (some_job->tasks->argv[0] == 0)
+	// ^C stopped a command substitution, and with it the whole job
+	if (expanded < 0)
 	{
-		printf("error: missing program\n");
+		close_redirections(some_job);
+		printf("\n");
 		some_job->status = 0;
+		record_status(128 + SIGINT);
 		return 0;
 	}
 
-	// if there is one and only one built-in command "cd", don't fork()
-	if (some_job->tasks->next == NULL)
+	// a lone "NAME=value ..." sets variables in the shell; its status is the
+	// one of the last command substitution in it, if there was one
+	Task *first = some_job->tasks;
+	if (first->argv[0] == NULL && first->assigns != NULL && first->next == NULL)
 	{
-		if (strcmp(some_job->tasks->argv[0], "cd") == 0 && !(some_job->background))
-		{
-			Task *curr = some_job->tasks;
-			if (curr->argv[1] == 0)
-			{
-				// cd to $HOME
-				// don't handle errors (it's guaranteed that TAs would use cd correctly)
-				do_cd(getenv("HOME"));
+		close_redirections(some_job);
+		if (!some_job->background)
+			for (char **assign = first->assigns; *assign != NULL; assign++)
+				var_assign(*assign, 0);
+		some_job->status = 0;
+		record_status(subst_runs != substs_before ? last_status : 0);
+		return 0;
+	}
 
-				// after each successful cd, update OLDPWD
-				setenv("OLDPWD", getenv("HOME"), 1);
-			}
-			else
-			{
-				// implementation of "cd -" is in do_cd()
-				error_code = do_cd(curr->argv[1]);
-				if (error_code < 0)
-				{
-					printf("%s", curr->argv[1]);
-					if (errno == ENOENT)
-						printf(": No such file or directory\n");
-					else if (errno == EACCES)
-						printf(": Permission denied\n");
-				}
-			}
-			some_job->status = 0;
-			return error_code;
-		}
-		else if (strcmp(some_job->tasks->argv[0], "exit") == 0 && !(some_job->background))
+	// do nothing if a task has no argv[0]: parse() lets only redirections
+	// through in the first one, and a substitution may expand to nothing
+	for (Task *task = some_job->tasks; task != NULL; task = task->next)
+		if (task->argv[0] == 0)
 		{
-			printf("exit\n");
-			return 114514; // 良い世、来いよ！
+			report("error: missing program\n");
+			close_redirections(some_job);
+			some_job->status = 0;
+			record_status(1);
+			return 0;
 		}
-	}
 
-	// we expect only one job
-	if (some_job->next != NULL)
-		return -1;
-	// ...but we expect more than one task!
+	// we expect more than one task!
 	Task *curr = some_job->tasks;
 	Task *next = curr->next;
 	Task *prev = curr->prev;
 
 	// prepare fds
-	int task_cnt = 0;
+	TRACE_BEGIN(pipes_start);
 	do
 	{
 		int pipefd[2];
@@ -94,14 +247,17 @@ int execute(Job *some_job, Job *jobs)
 			if (prev == NULL)
 			{
 				// only task, just skip this task and return
+				close_redirections(some_job);
 				some_job->status = 0;
+				record_status(1);
 				return 0;
 			}
 			else
 			{
-				// last task, delete this one
-				free(curr->argv);
+				// last task, delete this one (its memory goes with the job's arena)
+				close(curr->srcfd);
 				prev->next = NULL;
+				some_job->last_task = prev;
 				break;
 			}
 		}
@@ -110,12 +266,13 @@ int execute(Job *some_job, Job *jobs)
 			// this only happens to first task, skip this; or if can't, return
 			if (next == NULL)
 			{
+				close_redirections(some_job);
 				some_job->status = 0;
+				record_status(1);
 				return 0;
 			}
 			else
 			{
-				free(curr->argv);
 				curr = next;
 				next = curr->next;
 				prev = NULL;
@@ -124,162 +281,288 @@ int execute(Job *some_job, Job *jobs)
 				some_job->tasks = curr;
 			}
 		}
-		// create pipe
-		if (pipe(pipefd) < 0)
-			return -1;
-		task_cnt++;
-		// update fds
+		// create pipe to the next task
 		if (next != NULL)
 		{
+			// close-on-exec keeps the other stages' pipes out of every child
+			if (pipe2(pipefd, O_CLOEXEC) < 0)
+			{
+				close_redirections(some_job);
+				return -1;
+			}
 			curr->dstfd = pipefd[1];
 			next->srcfd = pipefd[0];
-		}
-		else
-		{
-			close(pipefd[1]); // close unused write end
+			pipebuf_apply(pipefd[1], curr->argv[0]);
 		}
 		// update curr, next, prev
 		prev = curr;
 		curr = next;
 		if (next != NULL)
 			next = curr->next;
-	} while (next != NULL);
+	} while (curr != NULL);
+
+	TRACE_END(pipes_start, "pipes", some_job->jobid);
 
 	// fd prepared well and piped
 	// but...is there an empty task?
 	curr = some_job->tasks;
 	if (*((curr->argv)[0]) == 0)
 	{
-		printf("error: missing program\n");
+		report("error: missing program\n");
+		// the pipes between the stages are in their srcfd and dstfd by now
+		close_redirections(some_job);
 		some_job->status = 0;
+		record_status(1);
 		return 0;
 	}
+
+	// a builtin at the end of a foreground job runs right here;
+	// "exit" only when it is on its own, it must not end the shell from a pipeline
+	Task *last = some_job->last_task;
+	const Builtin *in_shell = NULL;
+	if (!(some_job->background))
+		in_shell = find_builtin(last);
+	if (in_shell != NULL && strcmp(in_shell->name, "exit") == 0 && last != some_job->tasks)
+		in_shell = NULL;
+
+	int timed = some_job->pipeline != NULL && some_job->pipeline->timed;
+	if (timed)
+		clock_gettime(CLOCK_MONOTONIC, &some_job->started);
+
 	// now do the job!
-	do
+	for (curr = some_job->tasks; curr != NULL; curr = curr->next)
 	{
-		curr->pid = fork();
-		// set pgid for struct some_job (pgid should be pid of first job)
-		if (curr == some_job->tasks && curr->pid != 0) // parent-only
-		{
-			some_job->pgid = curr->pid;
-			// put child to foreground if it's not background
-			if (!(some_job->background))
-				tcsetpgrp(STDIN_FILENO, some_job->pgid);
-		}
-		if (curr->pid == 0) // child
-		{
-			// the most important thing upon successful fork is to restore SIGINT, SIGCHLD and SIGTTOU
-			signal(SIGINT, SIG_DFL);
-			signal(SIGTTOU, SIG_DFL);
-			signal(SIGCHLD, SIG_DFL);
+		if (curr == last && in_shell != NULL)
+			break;
+		// with job control (or in the background) a job gets a process group
+		// of its own, led by its first process; ^C then reaches only that group
+		pid_t pgid = -1;
+		if (some_job->background || interactive)
+			pgid = some_job->pgid;
 
-			// if this is the first child (and it's background), set pgid to pid
-			if (some_job->background)
-			{
-				if (curr == some_job->tasks)
-					setpgid(getpid(), getpid());
-				else
-					// attach to pgroup of 1st child
-					setpgid(getpid(), some_job->pgid);
-			}
-			// first do dup2
-			// since invalid tasks are already deleted, we don't need to check
-			dup2(curr->dstfd, STDOUT_FILENO);
-			dup2(curr->srcfd, STDIN_FILENO);
-			// next check for built-in commands
-			if (strcmp(curr->argv[0], "cd") == 0)
-			{
-				if (curr->argv[1] == 0)
-				{
-					// cd to $HOME
-					// if $HOME is not set, cd to /
-					if (do_cd(getenv("HOME")) < 0)
-						do_cd("/");
-				}
-				else
-					error_code = do_cd(curr->argv[1]);
-				if (error_code < 0)
-				{
-					printf("%s", curr->argv[1]);
-					if (errno == ENOENT)
-						printf(": No such file or directory\n");
-					else if (errno == EACCES)
-						printf(": Permission denied\n");
-				}
-				return 114514;
-			}
-			else if (strcmp(curr->argv[0], "exit") == 0)
-			{
-				// exit
-				// we are essentially subshell tho
-				return 114514;
-			}
-			else if (strcmp(curr->argv[0], "jobs") == 0)
-			{
-				// list jobs
-				do_jobs(jobs);
-				return 114514;
-			}
-			else if (strcmp(curr->argv[0], "pwd") == 0)
+		TRACE_BEGIN(spawn_start);
+		const Builtin *builtin = find_builtin(curr);
+		if (builtin != NULL)
+		{
+			// builtins need a copy of the shell, so they keep the fork path
+			curr->pid = fork();
+			if (curr->pid == 0) // child
+				builtin_child(builtin, curr, jobs, pgid);
+			if (curr->pid < 0)
 			{
-				do_pwd();
-				return 114514;
+				curr->pid = 0;
+				curr->exit_code = 1;
 			}
-			else
+		}
+		else
+			start_command(curr, pgid);
+		TRACE_END_CHILD(spawn_start, "spawn", some_job->jobid, curr->pid);
+		// set pgid for struct some_job (pgid should be pid of first job)
+		if (pgid >= 0 && curr->pid > 0) // parent-only
+		{
+			// the child may not have got there yet, and the group must exist before tcsetpgrp()
+			setpgid(curr->pid, pgid ? pgid : curr->pid);
+			if (some_job->pgid == 0)
 			{
-				// finally, time to execvp...
-				error_code = execvp((curr->argv)[0], curr->argv);
-				if (error_code < 0)
-					// check errno
-					switch (errno)
-					{
-					case ENOENT:
-						printf("%s", (curr->argv)[0]);
-						printf(": command not found\n");
-						return 114514;
-					case EACCES:
-						printf("%s", (curr->argv)[0]);
-						printf(": Permission denied\n");
-						return 114514;
-					default:
-						// can't handle more...
-						break;
-					}
-				return 114514;
+				some_job->pgid = curr->pid;
+				// put child to foreground if it's not background
+				if (!(some_job->background))
+					tcsetpgrp(STDIN_FILENO, some_job->pgid);
 			}
 		}
-		else // parent
+		if (curr->pid > 0)
 		{
 			some_job->chldcnt++;
-			// close fds of this child
-			if (curr->srcfd != 0)
-				close(curr->srcfd);
-			if (curr->dstfd != 1)
-				close(curr->dstfd);
+			add_pid(jobs, curr);
 		}
-		error_code = 0;
-		curr = curr->next;
-	} while (curr != NULL);
+		// close fds of this child
+		if (curr->srcfd != 0)
+			close(curr->srcfd);
+		if (curr->dstfd != 1)
+			close(curr->dstfd);
+	}
+
+	if (in_shell != NULL)
+	{
+		// the builtin's share of the shell's own usage
+		struct rusage before;
+		if (timed)
+			getrusage(RUSAGE_SELF, &before);
+		TRACE_BEGIN(builtin_start);
+		last->exit_code = builtin_in_shell(in_shell, last, jobs);
+		TRACE_END(builtin_start, "builtin", some_job->jobid);
+		if (timed)
+		{
+			getrusage(RUSAGE_SELF, &last->rusage);
+			rusage_since(&last->rusage, &before);
+		}
+	}
 
 	// wait for all children
 	// if it's background, don't wait
 	int status;
 	if (!(some_job->background))
 	{
-		for (int i = 0; i <= task_cnt; i++)
-			waitpid(0, &status, 0);
+		// wait for exactly our own children, stage by stage; background ones are left
+		// to the main loop
+		for (curr = some_job->tasks; curr != NULL; curr = curr->next)
+		{
+			if (curr->pid <= 0)
+				continue;
+			struct rusage rusage;
+			pid_t pid;
+			TRACE_BEGIN(wait_start);
+			do
+				pid = wait4(curr->pid, &status, 0, &rusage);
+			while (pid < 0 && errno == EINTR);
+			if (pid > 0)
+				finish_task(jobs, pid, status, &rusage);
+			TRACE_END_CHILD(wait_start, "wait", some_job->jobid, curr->pid);
+		}
+		// the status of a pipeline is the status of its last task
+		record_pipeline(some_job);
+		pipebuf_learn(some_job);
+		if (timed)
+		{
+			clock_gettime(CLOCK_MONOTONIC, &some_job->finished);
+			report_times(some_job);
+		}
+		// ^C killed it, start the prompt on a new line like Bash
+		if (interactive && last->exit_code == 128 + SIGINT)
+			printf("\n");
 		some_job->status = 0;
 	}
 	else
 	{
-		// print job info
-		printf("[%d] %s\n", some_job->jobid, some_job->cmdline);
+		// nothing could be started at all
+		if (some_job->chldcnt == 0)
+			some_job->status = 0;
+		// print job info, unless that was done when it was queued
+		if (!some_job->queued)
+		{
+			if (interactive)
+				printf("[%d] %s\n", some_job->jobid, some_job->cmdline);
+			record_status(0);
+		}
 	}
 
-	// restore stdin and stdout
-	dup2(saved_stdin, STDIN_FILENO);
-	dup2(saved_stdout, STDOUT_FILENO);
-	tcsetpgrp(STDIN_FILENO, getpgrp());
+	// take the terminal back
+	if (interactive)
+		tcsetpgrp(STDIN_FILENO, getpgrp());
 
-	return error_code;
+	if (shell_exiting)
+		return 114514; // 良い世、来いよ！
+	return 0;
+}
+
+/**
+ * execute - execute "only one" command line
+ * Builtins run in the shell process when they are the last stage of a
+ * foreground job (or the whole of it); everything else gets a process.
+ * A background job needs a job slot to start (see jobslot.c); without
+ * one it waits in the job table's queue for start_queued().
+ * @param some_job A Job structure, which contains all the tasks
+ * @param jobs the job table, which learns the pid of every child
+ * @return 0 on success, 114514 if the shell should exit, otherwise error
+ */
+int execute(Job *some_job, JobTable *jobs)
+{
+	// blank line, nothing to run
+	if (some_job->tasks->cmd == NULL)
+	{
+		some_job->status = 0;
+		return 0;
+	}
+	if (some_job->background && !jobslot_acquire(some_job))
+	{
+		some_job->queued = 1;
+		queue_job(jobs, some_job);
+		if (interactive)
+			printf("[%d] %s\n", some_job->jobid, some_job->cmdline);
+		record_status(0);
+		return 0;
+	}
+	int status = run_job(some_job, jobs);
+	// nothing was started, so nothing will give the slot back
+	if (some_job->background && some_job->chldcnt == 0)
+		jobslot_release(some_job);
+	return status;
+}
+
+/**
+ * Run the jobs parse() made of one line, in order. Each job goes into the
+ * job table while it runs; a foreground one leaves it when it is done.
+ * @param job the first job of the list, chained by next_listed
+ * @param jobs the job table
+ * @return as execute() for the last job run; 114514 stops the rest
+ */
+int execute_list(Job *job, JobTable *jobs)
+{
+	int return_code = 0;
+	while (job != NULL)
+	{
+		Job *next_job = job->next_listed;
+		// && and || look at the status of the pipeline before, which a
+		// skipped one leaves as it is
+		int connector = job->pipeline->connector;
+		if ((connector == LIST_AND && last_status != 0) || (connector == LIST_OR && last_status == 0))
+		{
+			free_job(job);
+			job = next_job;
+			continue;
+		}
+
+		add_job(job, jobs);
+		TRACE_BEGIN(execute_start);
+		return_code = execute(job, jobs);
+		TRACE_END(execute_start, "execute", job->jobid);
+		// a foreground job is done once execute() returns
+		int stop = return_code == 114514;
+		if (!job->background)
+		{
+			TRACE_BEGIN(cleanup_start);
+			int jobid = job->jobid;
+			remove_job(job, jobs);
+			TRACE_END(cleanup_start, "cleanup", jobid);
+			// ^C stops the whole list, not just the job it hit
+			if (interactive && last_status == 128 + SIGINT)
+				stop = 1;
+		}
+		job = next_job;
+		if (stop)
+			while (job != NULL)
+			{
+				next_job = job->next_listed;
+				free_job(job);
+				job = next_job;
+			}
+	}
+	return return_code;
+}
+
+/**
+ * Start queued background jobs, oldest first, while there are job slots.
+ * They start in between other commands, so $? and $PIPESTATUS are kept.
+ * @param jobs the job table
+ */
+void start_queued(JobTable *jobs)
+{
+	if (jobs->queue == NULL)
+		return;
+	int saved_status = last_status;
+	int *saved_pipe = malloc(sizeof(int) * (npipe_status ? npipe_status : 1));
+	int saved_npipe = npipe_status;
+	if (npipe_status > 0)
+		memcpy(saved_pipe, pipe_status, sizeof(int) * npipe_status);
+	while (jobs->queue != NULL && jobslot_acquire(jobs->queue))
+	{
+		Job *job = jobs->queue;
+		unqueue_job(jobs, job);
+		execute(job, jobs);
+		job->queued = 0;
+	}
+	last_status = saved_status;
+	free(pipe_status);
+	pipe_status = saved_pipe;
+	npipe_status = saved_npipe;
 }
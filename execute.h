@@ -12,6 +12,13 @@
 #include <errno.h>
 #include "jobs.h"
 
-int execute(Job *some_job, Job *jobs);
+extern int last_status;
+extern int *pipe_status;
+extern int npipe_status;
+
+int execute(Job *some_job, JobTable *jobs);
+int execute_list(Job *job, JobTable *jobs);
+void start_command(Task *curr, pid_t pgid);
+void start_queued(JobTable *jobs);
 
 #endif
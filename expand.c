@@ -0,0 +1,452 @@
+// expand.c: Turn the syntax tree of a task into argv and file descriptors
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "expand.h"
+#include "execute.h"
+#include "parse.h"
+#include "subst.h"
+#include "var.h"
+#include "wildcard.h"
+#include "report.h"
+
+// Output of expand_params(). Fields are split off by '\0', which no
+// argument can hold. Fields that become patterns get a '\' in front of each
+// character that was quoted and would otherwise match more than itself.
+typedef struct _expansion
+{
+	FILE *out;
+	int written;  // the word has given at least one field
+	int in_field; // the current field has something in it
+	int pending;  // blanks ended the field; '\0' goes out before more text
+	int nfields;
+	int glob; // the fields are patterns for glob_expand()
+} Expansion;
+
+// a wildcard outside quotes
+static int has_glob(Word *word)
+{
+	for (WordPart *part = word->parts; part != NULL; part = part->next)
+		if (!part->quoted)
+			for (size_t i = 0; i < part->len; i++)
+				if (part->text[i] == '*' || part->text[i] == '?' || part->text[i] == '[')
+					return 1;
+	return 0;
+}
+
+// a '$' or '`' that may start an expansion: anywhere but inside single quotes
+static int has_expansion(Word *word)
+{
+	for (WordPart *part = word->parts; part != NULL; part = part->next)
+		if (part->quoted != '\'' &&
+		    (memchr(part->text, '$', part->len) != NULL || memchr(part->text, '`', part->len) != NULL))
+			return 1;
+	return 0;
+}
+
+// an expansion outside quotes, whose value splits into fields
+static int has_unquoted_expansion(Word *word)
+{
+	for (WordPart *part = word->parts; part != NULL; part = part->next)
+		if (!part->quoted &&
+		    (memchr(part->text, '$', part->len) != NULL || memchr(part->text, '`', part->len) != NULL))
+			return 1;
+	return 0;
+}
+
+static const char *find_expansion(const char *text, size_t len)
+{
+	for (size_t i = 0; i < len; i++)
+		if (text[i] == '$' || text[i] == '`')
+			return text + i;
+	return NULL;
+}
+
+// more text for the current field, which the blanks before it may have ended
+static void field_start(Expansion *e)
+{
+	if (e->pending)
+	{
+		fputc('\0', e->out);
+		e->nfields++;
+		e->pending = 0;
+	}
+	e->written = 1;
+	e->in_field = 1;
+}
+
+static void emit(Expansion *e, const char *text, size_t len, int quoted)
+{
+	if (len == 0)
+		return;
+	field_start(e);
+	if (!e->glob)
+	{
+		fwrite(text, 1, len, e->out);
+		return;
+	}
+	for (size_t i = 0; i < len; i++)
+	{
+		if (text[i] == '\\' || (quoted && (text[i] == '*' || text[i] == '?' || text[i] == '[')))
+			fputc('\\', e->out);
+		fputc(text[i], e->out);
+	}
+}
+
+// value of an unquoted expansion: runs of blanks end fields
+static void emit_fields(Expansion *e, const char *text, size_t len)
+{
+	size_t i = 0;
+	while (i < len)
+	{
+		size_t j = i;
+		while (j < len && text[j] != ' ' && text[j] != '\t' && text[j] != '\n')
+			j++;
+		emit(e, text + i, j - i, 0);
+		if (j < len && e->in_field)
+		{
+			e->pending = 1;
+			e->in_field = 0;
+		}
+		while (j < len && (text[j] == ' ' || text[j] == '\t' || text[j] == '\n'))
+			j++;
+		i = j;
+	}
+}
+
+/**
+ * Look up the variable whose name starts at s, right after a '$': $NAME or
+ * ${NAME}. PIPESTATUS is left to special_param().
+ * @param s the text after '$'
+ * @param len its length
+ * @param value where its value is stored, NULL if it is not set
+ * @return characters of s used, 0 if there is no name there
+ */
+static size_t var_param(const char *s, size_t len, const char **value)
+{
+	size_t braced = len > 0 && s[0] == '{';
+	size_t n = var_name_len(s + braced, len - braced);
+	if (n == 0 || (braced && (braced + n >= len || s[braced + n] != '}')))
+		return 0;
+	if (n == 10 && memcmp(s + braced, "PIPESTATUS", 10) == 0)
+		return 0;
+	*value = var_getn(s + braced, n);
+	return n + 2 * braced;
+}
+
+/**
+ * Expand the special parameter whose name starts at s, right after a '$'.
+ * Understood are $?, ${?}, $PIPESTATUS, ${PIPESTATUS}, ${PIPESTATUS[n]}
+ * and ${PIPESTATUS[@]} (or [*], all stages separated by spaces).
+ * @param out where the value is written
+ * @param s the text after '$'
+ * @param len its length
+ * @return characters of s used, 0 if it is not a parameter we know
+ */
+static size_t special_param(FILE *out, const char *s, size_t len)
+{
+	static const char name[] = "PIPESTATUS";
+	size_t name_len = sizeof(name) - 1;
+	if (len >= 1 && s[0] == '?')
+	{
+		fprintf(out, "%d", last_status);
+		return 1;
+	}
+	if (len >= 3 && memcmp(s, "{?}", 3) == 0)
+	{
+		fprintf(out, "%d", last_status);
+		return 3;
+	}
+	if (len >= name_len && memcmp(s, name, name_len) == 0 &&
+	    (len == name_len || !(isalnum((unsigned char)s[name_len]) || s[name_len] == '_')))
+	{
+		if (npipe_status > 0)
+			fprintf(out, "%d", pipe_status[0]);
+		return name_len;
+	}
+	if (len < name_len + 2 || s[0] != '{' || memcmp(s + 1, name, name_len) != 0)
+		return 0;
+	size_t i = name_len + 1;
+	if (s[i] == '}')
+	{
+		if (npipe_status > 0)
+			fprintf(out, "%d", pipe_status[0]);
+		return i + 1;
+	}
+	if (s[i] != '[')
+		return 0;
+	const char *close = memchr(s + i, ']', len - i);
+	if (close == NULL || (size_t)(close - s) + 1 >= len || close[1] != '}')
+		return 0;
+	const char *index = s + i + 1;
+	size_t index_len = close - index;
+	if (index_len == 1 && (*index == '@' || *index == '*'))
+	{
+		for (int n = 0; n < npipe_status; n++)
+			fprintf(out, n ? " %d" : "%d", pipe_status[n]);
+	}
+	else
+	{
+		// past the last stage the index only has to be digits, it prints nothing
+		int n = 0;
+		for (size_t j = 0; j < index_len; j++)
+		{
+			if (!isdigit((unsigned char)index[j]))
+				return 0;
+			if (n < npipe_status)
+				n = n * 10 + index[j] - '0';
+		}
+		if (index_len > 0 && n < npipe_status)
+			fprintf(out, "%d", pipe_status[n]);
+	}
+	return close - s + 2;
+}
+
+/**
+ * Quote removal, parameter expansion and command substitution, for the rare
+ * word that has a '$' or '`'.
+ * @param word the word
+ * @param arena where the result is allocated
+ * @param jobs the job table, for command substitutions
+ * @param split whether unquoted expansions split into fields
+ * @param glob whether the fields are to be patterns for glob_expand()
+ * @param nfields where the number of fields is stored when split is set
+ * @return the fields, each ended by '\0'; NULL on failure
+ */
+static char *expand_params(Word *word, Arena *arena, JobTable *jobs, int split, int glob, int *nfields)
+{
+	char *buf = NULL;
+	size_t size = 0;
+	Expansion e = {open_memstream(&buf, &size), 0, 0, 0, 1, glob};
+	if (e.out == NULL)
+		return NULL;
+	for (WordPart *part = word->parts; part != NULL; part = part->next)
+	{
+		// even an empty quoted part makes a field
+		if (part->quoted)
+			field_start(&e);
+		size_t i = 0;
+		while (i < part->len)
+		{
+			const char *mark = NULL;
+			if (part->quoted != '\'')
+				mark = find_expansion(part->text + i, part->len - i);
+			size_t n = mark ? (size_t)(mark - (part->text + i)) : part->len - i;
+			emit(&e, part->text + i, n, part->quoted);
+			i += n;
+			if (mark == NULL)
+				break;
+			ssize_t subst = subst_len(part->text + i, part->len - i);
+			if (subst > 0)
+			{
+				size_t skip = part->text[i] == '`' ? 1 : 2;
+				size_t len = 0;
+				char *output = command_subst(part->text + i + skip, subst - skip - 1, jobs, &len);
+				if (output != NULL && split && !part->quoted)
+					emit_fields(&e, output, len);
+				else if (output != NULL)
+					emit(&e, output, len, part->quoted);
+				free(output);
+				i += subst;
+				continue;
+			}
+			const char *value = NULL;
+			size_t used = *mark == '$' ? var_param(part->text + i + 1, part->len - i - 1, &value) : 0;
+			if (used > 0)
+			{
+				// an unset variable is nothing at all
+				if (value != NULL && split && !part->quoted)
+					emit_fields(&e, value, strlen(value));
+				else if (value != NULL)
+					emit(&e, value, strlen(value), part->quoted);
+				i += 1 + used;
+				continue;
+			}
+			// anything we don't know stays as it is
+			field_start(&e);
+			if (*mark == '$')
+				used = special_param(e.out, part->text + i + 1, part->len - i - 1);
+			if (used == 0)
+				fputc(*mark, e.out);
+			i += 1 + used;
+		}
+	}
+	fclose(e.out);
+	if (nfields != NULL)
+		*nfields = e.written ? e.nfields : 0;
+	char *str = arena_strndup(arena, buf, size);
+	free(buf);
+	return str;
+}
+
+/**
+ * Quote removal: concatenate the slices of a word into one string.
+ * The length is known up front, so each word is copied exactly once;
+ * only words with a '$' or '`' take the slower path that expands them.
+ * @param word the word
+ * @param arena where the string is allocated
+ * @param jobs the job table, for command substitutions
+ * @return the NUL-terminated word
+ */
+char *expand_word(Word *word, Arena *arena, JobTable *jobs)
+{
+	char *str;
+	if (has_expansion(word) && (str = expand_params(word, arena, jobs, 0, 0, NULL)) != NULL)
+		return str;
+	str = arena_alloc(arena, word->len + 1);
+	char *dest = str;
+	for (WordPart *part = word->parts; part != NULL; part = part->next)
+	{
+		memcpy(dest, part->text, part->len);
+		dest += part->len;
+	}
+	return str;
+}
+
+// write all of buf, or fail
+static int write_all(int fd, const char *buf, size_t len)
+{
+	while (len > 0)
+	{
+		ssize_t n = write(fd, buf, len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0)
+			return -1;
+		buf += n;
+		len -= n;
+	}
+	return 0;
+}
+
+/**
+ * Give the text of a here-document or here-string a file descriptor to be
+ * read from: a pipe when it fits in one without a reader on the other end,
+ * otherwise a memfd. Nothing touches the disk and nothing needs cleaning up.
+ * @param redir the redirection
+ * @param arena where the expanded text is allocated
+ * @param jobs the job table, for command substitutions
+ * @return the read end, -1 on failure (reported here)
+ */
+static int here_fd(Redir *redir, Arena *arena, JobTable *jobs)
+{
+	char *text;
+	size_t len;
+	if (redir->type == REDIR_HEREDOC)
+	{
+		text = expand_word(redir->body, arena, jobs);
+		len = strlen(text);
+	}
+	else
+	{
+		// a here-string gets the newline the word does not have
+		char *word = expand_word(redir->target, arena, jobs);
+		len = strlen(word) + 1;
+		text = arena_alloc(arena, len + 1);
+		memcpy(text, word, len - 1);
+		text[len - 1] = '\n';
+	}
+	int fds[2];
+	if (len <= PIPE_BUF && pipe2(fds, O_CLOEXEC) == 0)
+	{
+		write_all(fds[1], text, len);
+		close(fds[1]);
+		return fds[0];
+	}
+	int fd = memfd_create("here-document", MFD_CLOEXEC);
+	if (fd >= 0 && (write_all(fd, text, len) < 0 || lseek(fd, 0, SEEK_SET) < 0))
+	{
+		close(fd);
+		fd = -1;
+	}
+	if (fd < 0)
+		report("here-document: %s\n", strerror(errno));
+	return fd;
+}
+
+/**
+ * Build argv of a task from its words and open its redirections.
+ * Errors on opening files are reported by prepare_fd() and leave a negative fd,
+ * which execute() knows how to skip.
+ * An unquoted expansion or wildcard may turn one word into any number of
+ * arguments, none included. Assignments in front of the command go to task->assigns.
+ * @param task the task
+ * @param arena arena of the job owning the task
+ * @param jobs the job table, for command substitutions
+ * @return 0, or -1 if ^C stopped a command substitution
+ */
+int expand_task(Task *task, Arena *arena, JobTable *jobs)
+{
+	Command *cmd = task->cmd;
+	if (cmd->nassigns > 0)
+	{
+		task->assigns = arena_alloc(arena, sizeof(char *) * (cmd->nassigns + 1));
+		int n = 0;
+		for (Word *word = cmd->assigns; word != NULL; word = word->next)
+			task->assigns[n++] = expand_word(word, arena, jobs);
+		task->assigns[n] = NULL;
+	}
+	int cap = cmd->nwords + 1;
+	task->argv = arena_alloc(arena, sizeof(char *) * cap);
+	int argc = 0;
+	for (Word *word = cmd->words; word != NULL; word = word->next)
+	{
+		int nfields;
+		char *field;
+		if ((!has_unquoted_expansion(word) && !has_glob(word)) ||
+		    (field = expand_params(word, arena, jobs, 1, 1, &nfields)) == NULL)
+		{
+			task->argv[argc++] = expand_word(word, arena, jobs);
+			continue;
+		}
+		for (int i = 0; i < nfields; i++)
+		{
+			char **paths;
+			int npaths = glob_expand(field, arena, &paths);
+			// the word had room for one argument
+			int more = npaths - (i == 0);
+			if (more > 0)
+			{
+				char **argv = arena_alloc(arena, sizeof(char *) * (cap + more));
+				memcpy(argv, task->argv, sizeof(char *) * argc);
+				task->argv = argv;
+				cap += more;
+			}
+			memcpy(task->argv + argc, paths, sizeof(char *) * npaths);
+			argc += npaths;
+			field += strlen(field) + 1;
+		}
+	}
+
+	task->srcfd = 0; // defaults to stdin
+	task->dstfd = 1; // defaults to stdout
+	for (Redir *redir = cmd->redirs; redir != NULL; redir = redir->next)
+	{
+		if (redir->type == REDIR_HEREDOC || redir->type == REDIR_HERESTRING)
+		{
+			task->srcfd = here_fd(redir, arena, jobs);
+			continue;
+		}
+		char *file = expand_word(redir->target, arena, jobs);
+		if (redir->type == REDIR_IN)
+			prepare_fd(file, &task->srcfd, redir->type);
+		else
+			prepare_fd(file, &task->dstfd, redir->type);
+	}
+	if (subst_interrupted)
+	{
+		subst_interrupted = 0;
+		return -1;
+	}
+	return 0;
+}
@@ -0,0 +1,11 @@
+// expand.h: Turn the syntax tree of a task into argv and file descriptors
+
+#ifndef EXPAND_H
+#define EXPAND_H
+
+#include "jobs.h"
+
+char *expand_word(Word *word, Arena *arena, JobTable *jobs);
+int expand_task(Task *task, Arena *arena, JobTable *jobs);
+
+#endif
@@ -0,0 +1,300 @@
+// hash.c: Table of resolved command paths and the "hash" builtin
+// Every external command used to go through execvp(), which tries each
+// $PATH entry in turn. We search $PATH once per command name and remember
+// the answer; a miss is remembered too, but only for a short while, since
+// the command may be installed any moment.
+
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "hash.h"
+#include "var.h"
+#include "report.h"
+
+// seconds a "command not found" is trusted
+#define HASH_NEGATIVE_TTL 2
+#define HASH_INITIAL_BUCKETS 64
+
+typedef struct _hash_entry
+{
+	char *name;
+	char *path;	  // NULL for a cached miss
+	int error;	  // errno of a cached miss
+	time_t expires;	  // for misses only
+	unsigned int hits;
+	struct _hash_entry *next;
+} HashEntry;
+
+static HashEntry **buckets = NULL;
+static size_t nbuckets = 0;
+static size_t nentries = 0;
+// $PATH the table was filled with; any change empties the table
+static char *hashed_path = NULL;
+
+// FNV-1a
+static size_t hash_name(const char *name)
+{
+	uint32_t h = 2166136261u;
+	while (*name)
+	{
+		h ^= (unsigned char)*name++;
+		h *= 16777619u;
+	}
+	return h;
+}
+
+static time_t now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec;
+}
+
+static void free_entry(HashEntry *entry)
+{
+	free(entry->name);
+	free(entry->path);
+	free(entry);
+}
+
+/**
+ * Empty the table, as "hash -r" does.
+ */
+void hash_clear(void)
+{
+	for (size_t i = 0; i < nbuckets; i++)
+	{
+		HashEntry *entry = buckets[i];
+		while (entry != NULL)
+		{
+			HashEntry *next = entry->next;
+			free_entry(entry);
+			entry = next;
+		}
+		buckets[i] = NULL;
+	}
+	nentries = 0;
+}
+
+/**
+ * Drop one command from the table, e.g. because its file went away.
+ */
+void hash_forget(const char *name)
+{
+	if (nbuckets == 0)
+		return;
+	HashEntry **link = &buckets[hash_name(name) % nbuckets];
+	while (*link != NULL)
+	{
+		if (strcmp((*link)->name, name) == 0)
+		{
+			HashEntry *entry = *link;
+			*link = entry->next;
+			free_entry(entry);
+			nentries--;
+			return;
+		}
+		link = &(*link)->next;
+	}
+}
+
+static void grow(void)
+{
+	size_t new_nbuckets = nbuckets ? nbuckets * 2 : HASH_INITIAL_BUCKETS;
+	HashEntry **new_buckets = calloc(new_nbuckets, sizeof(HashEntry *));
+	for (size_t i = 0; i < nbuckets; i++)
+	{
+		HashEntry *entry = buckets[i];
+		while (entry != NULL)
+		{
+			HashEntry *next = entry->next;
+			size_t slot = hash_name(entry->name) % new_nbuckets;
+			entry->next = new_buckets[slot];
+			new_buckets[slot] = entry;
+			entry = next;
+		}
+	}
+	free(buckets);
+	buckets = new_buckets;
+	nbuckets = new_nbuckets;
+}
+
+// the table is only good for the $PATH it was built from
+static void check_path(void)
+{
+	const char *path = var_get("PATH");
+	if (path == NULL)
+		path = "/usr/local/bin:/usr/bin:/bin";
+	if (hashed_path != NULL && strcmp(hashed_path, path) == 0)
+		return;
+	free(hashed_path);
+	hashed_path = strdup(path);
+	hash_clear();
+}
+
+// walk $PATH like execvp() does; returns a malloc'd path or NULL with *error set
+static char *search_path(const char *name, int *error)
+{
+	size_t name_len = strlen(name);
+	const char *dir = hashed_path;
+	*error = ENOENT;
+	while (1)
+	{
+		const char *end = strchr(dir, ':');
+		size_t dir_len = end ? (size_t)(end - dir) : strlen(dir);
+		// an empty entry means the current directory
+		char *candidate = malloc(dir_len + name_len + 3);
+		if (dir_len == 0)
+			strcpy(candidate, ".");
+		else
+		{
+			memcpy(candidate, dir, dir_len);
+			candidate[dir_len] = 0;
+		}
+		strcat(candidate, "/");
+		strcat(candidate, name);
+		struct stat st;
+		if (stat(candidate, &st) == 0 && S_ISREG(st.st_mode))
+		{
+			if (access(candidate, X_OK) == 0)
+				return candidate;
+			*error = EACCES;
+		}
+		free(candidate);
+		if (end == NULL)
+			return NULL;
+		dir = end + 1;
+	}
+}
+
+static HashEntry *find(const char *name)
+{
+	if (nbuckets == 0)
+		return NULL;
+	for (HashEntry *entry = buckets[hash_name(name) % nbuckets]; entry != NULL; entry = entry->next)
+		if (strcmp(entry->name, name) == 0)
+			return entry;
+	return NULL;
+}
+
+/**
+ * Resolve a command name to the file to exec.
+ * Names containing a slash are used as they are.
+ * @param name argv[0] of the command
+ * @param error set to ENOENT or EACCES when NULL is returned
+ * @return the path, owned by the table; NULL if there is no such command
+ */
+const char *hash_lookup(const char *name, int *error)
+{
+	if (strchr(name, '/') != NULL)
+		return name;
+	check_path();
+	HashEntry *entry = find(name);
+	if (entry != NULL && entry->path == NULL && entry->expires <= now())
+	{
+		// the miss is too old to be trusted, look again
+		hash_forget(name);
+		entry = NULL;
+	}
+	if (entry == NULL)
+	{
+		if (nentries >= nbuckets)
+			grow();
+		entry = calloc(1, sizeof(HashEntry));
+		entry->name = strdup(name);
+		entry->path = search_path(name, &entry->error);
+		if (entry->path == NULL)
+			entry->expires = now() + HASH_NEGATIVE_TTL;
+		size_t slot = hash_name(name) % nbuckets;
+		entry->next = buckets[slot];
+		buckets[slot] = entry;
+		nentries++;
+	}
+	if (entry->path == NULL)
+	{
+		*error = entry->error;
+		return NULL;
+	}
+	entry->hits++;
+	return entry->path;
+}
+
+/**
+ * Shell built-in "hash" command
+ * hash             list remembered commands
+ * hash -r          forget all of them
+ * hash -d name...  forget some of them
+ * hash -t name...  print where they are
+ * hash name...     look them up and remember them
+ * @param argv arguments, argv[0] is "hash"
+ * @return exit status
+ */
+int do_hash(char **argv)
+{
+	check_path();
+	if (argv[1] == NULL)
+	{
+		int empty = 1;
+		for (size_t i = 0; i < nbuckets; i++)
+			for (HashEntry *entry = buckets[i]; entry != NULL; entry = entry->next)
+			{
+				if (entry->path == NULL)
+					continue;
+				if (empty)
+					printf("hits\tcommand\n");
+				empty = 0;
+				printf("%4u\t%s\n", entry->hits, entry->path);
+			}
+		if (empty)
+			printf("hash: hash table empty\n");
+		return 0;
+	}
+	if (strcmp(argv[1], "-r") == 0)
+	{
+		hash_clear();
+		return 0;
+	}
+
+	int status = 0;
+	int i = 1;
+	int forget = strcmp(argv[1], "-d") == 0;
+	int print = strcmp(argv[1], "-t") == 0;
+	if (forget || print)
+		i++;
+	for (; argv[i] != NULL; i++)
+	{
+		if (forget)
+		{
+			if (find(argv[i]) == NULL)
+			{
+				report("hash: %s: not found\n", argv[i]);
+				status = 1;
+			}
+			hash_forget(argv[i]);
+			continue;
+		}
+		int error = 0;
+		const char *path = hash_lookup(argv[i], &error);
+		if (path == NULL)
+		{
+			report("hash: %s: not found\n", argv[i]);
+			status = 1;
+			continue;
+		}
+		// looking a command up for the user doesn't count as using it
+		HashEntry *entry = find(argv[i]);
+		if (entry != NULL)
+			entry->hits--;
+		if (print)
+			printf("%s\n", path);
+	}
+	return status;
+}
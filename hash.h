@@ -0,0 +1,11 @@
+// hash.h: Table of resolved command paths and the "hash" builtin
+
+#ifndef HASH_H
+#define HASH_H
+
+const char *hash_lookup(const char *name, int *error);
+void hash_forget(const char *name);
+void hash_clear(void);
+int do_hash(char **argv);
+
+#endif
@@ -0,0 +1,297 @@
+// history.c: Command history, shared by all the shells of a user
+// Each line run at the prompt is appended to the history file as one record:
+// a magic number and the length, the text, and the length once more. A record
+// goes out in a single write() to a file opened with O_APPEND, so shells
+// writing at the same time never mix their records up, and nothing is ever
+// rewritten on exit. The file is read through mmap(): starting up costs an
+// open() and a mmap() whatever its size, and the records are only indexed
+// when "history" asks for them. When the file grows past HISTORY_MAX_BYTES,
+// the shell that made it so copies the newest half to a new file and renames
+// it over the old one. Appending holds a shared flock() and compacting an
+// exclusive one, so no record can go into the old file after the rename.
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "history.h"
+#include "var.h"
+#include "report.h"
+
+#define HISTORY_MAX_BYTES (1 << 20)
+#define HISTORY_MAGIC 0x3148534du // "MSH1"
+// magic and length in front, length behind
+#define HEADER_SIZE 8
+#define TRAILER_SIZE 4
+
+static char *path = NULL;
+static int fd = -1;
+static char *map = NULL;
+static size_t map_size = 0;
+// start of every record indexed so far, and where the next one would start
+static size_t *offsets = NULL;
+static size_t nentries = 0;
+static size_t cap = 0;
+static size_t indexed_end = 0;
+// the lines typed so far for the command being entered, in a record
+static char *pending = NULL;
+static size_t pending_len = 0;
+static size_t pending_cap = 0;
+
+static uint32_t load_u32(const char *p)
+{
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static void unmap(void)
+{
+	if (map != NULL)
+		munmap(map, map_size);
+	map = NULL;
+	map_size = 0;
+}
+
+// open the file at path afresh, forgetting what we knew of the old one
+static int open_file(void)
+{
+	if (fd >= 0)
+		close(fd);
+	unmap();
+	nentries = 0;
+	indexed_end = 0;
+	fd = open(path, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+	return fd;
+}
+
+// whether path still leads to the file we have open; compacting replaces it
+static int is_current(void)
+{
+	struct stat ours, named;
+	return fstat(fd, &ours) == 0 && stat(path, &named) == 0 && ours.st_dev == named.st_dev &&
+	       ours.st_ino == named.st_ino;
+}
+
+// map the file as it is now, which other shells may have added to
+static void remap(void)
+{
+	struct stat st;
+	if (fstat(fd, &st) < 0 || (size_t)st.st_size == map_size)
+		return;
+	unmap();
+	if (st.st_size == 0)
+		return;
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED)
+	{
+		map = NULL;
+		return;
+	}
+	map_size = st.st_size;
+}
+
+/**
+ * Index the records added since the last time. A record that does not check
+ * out (a shell died halfway through writing it) is skipped by looking for the
+ * next magic number.
+ */
+static void index_records(void)
+{
+	size_t pos = indexed_end;
+	while (pos + HEADER_SIZE + TRAILER_SIZE <= map_size)
+	{
+		uint32_t len = load_u32(map + pos + 4);
+		if (load_u32(map + pos) != HISTORY_MAGIC || len > map_size - pos - HEADER_SIZE - TRAILER_SIZE ||
+		    load_u32(map + pos + HEADER_SIZE + len) != len)
+		{
+			pos++;
+			continue;
+		}
+		if (nentries == cap)
+		{
+			cap = cap ? cap * 2 : 256;
+			offsets = realloc(offsets, sizeof(size_t) * cap);
+		}
+		offsets[nentries++] = pos;
+		pos += HEADER_SIZE + len + TRAILER_SIZE;
+	}
+	indexed_end = pos;
+}
+
+/**
+ * Find the history file and map it; nothing in it is read yet. The file is
+ * $HISTFILE, or ~/.mumsh_history; an empty $HISTFILE turns history off.
+ */
+void history_init(void)
+{
+	const char *file = var_get("HISTFILE");
+	if (file == NULL)
+	{
+		const char *home = var_get("HOME");
+		if (home == NULL)
+			return;
+		if (asprintf(&path, "%s/.mumsh_history", home) < 0)
+			path = NULL;
+	}
+	else if (*file != '\0')
+		path = strdup(file);
+	if (path == NULL || open_file() < 0)
+		return;
+	remap();
+}
+
+// keep the newest half of the file: copy it to a new file and put that in place
+static void compact(void)
+{
+	flock(fd, LOCK_EX);
+	// another shell may have done it while we waited
+	if (!is_current())
+	{
+		flock(fd, LOCK_UN);
+		open_file();
+		return;
+	}
+	remap();
+	index_records();
+	size_t i = 0;
+	while (i < nentries && map_size - offsets[i] > HISTORY_MAX_BYTES / 2)
+		i++;
+	char *tmp;
+	if (i == 0 || i == nentries || asprintf(&tmp, "%s.XXXXXX", path) < 0)
+	{
+		flock(fd, LOCK_UN);
+		return;
+	}
+	int out = mkstemp(tmp);
+	size_t len = map_size - offsets[i];
+	if (out >= 0 && write(out, map + offsets[i], len) == (ssize_t)len && fchmod(out, 0600) == 0 &&
+	    rename(tmp, path) == 0)
+	{
+		close(out);
+		flock(fd, LOCK_UN);
+		open_file();
+	}
+	else
+	{
+		if (out >= 0)
+		{
+			close(out);
+			unlink(tmp);
+		}
+		flock(fd, LOCK_UN);
+	}
+	free(tmp);
+}
+
+/**
+ * Take a line typed for the command being entered; a command that goes on
+ * over several lines (or has here-documents) makes one entry of them all.
+ * @param line the line, as read
+ * @param len its length
+ */
+void history_collect(const char *line, size_t len)
+{
+	if (fd < 0)
+		return;
+	size_t need = HEADER_SIZE + pending_len + len + TRAILER_SIZE;
+	if (need > pending_cap)
+	{
+		pending_cap = need > pending_cap * 2 ? need : pending_cap * 2;
+		pending = realloc(pending, pending_cap);
+	}
+	memcpy(pending + HEADER_SIZE + pending_len, line, len);
+	pending_len += len;
+}
+
+// forget the lines collected, as for a command dropped with ^C
+void history_discard(void)
+{
+	pending_len = 0;
+}
+
+/**
+ * Append the command whose lines were collected to the history file.
+ * The newline that ended it is left out.
+ */
+void history_add(void)
+{
+	size_t len = pending_len;
+	pending_len = 0;
+	if (fd < 0)
+		return;
+	while (len > 0 && pending[HEADER_SIZE + len - 1] == '\n')
+		len--;
+	if (len == 0 || len > HISTORY_MAX_BYTES / 4)
+		return;
+
+	// the text is in place already, between the header and the trailer
+	size_t size = HEADER_SIZE + len + TRAILER_SIZE;
+	char *record = pending;
+	uint32_t head[2] = {HISTORY_MAGIC, len};
+	uint32_t tail = len;
+	memcpy(record, head, HEADER_SIZE);
+	memcpy(record + HEADER_SIZE + len, &tail, TRAILER_SIZE);
+
+	// the file we hold may have been replaced since we opened it
+	for (;;)
+	{
+		flock(fd, LOCK_SH);
+		if (is_current())
+			break;
+		flock(fd, LOCK_UN);
+		if (open_file() < 0)
+			return;
+	}
+	ssize_t n;
+	while ((n = write(fd, record, size)) < 0 && errno == EINTR)
+		;
+	struct stat st;
+	int full = fstat(fd, &st) == 0 && st.st_size > HISTORY_MAX_BYTES;
+	flock(fd, LOCK_UN);
+	if (full)
+		compact();
+}
+
+/**
+ * history: list the lines run so far, by every shell using the file.
+ * @param argv "history", optionally followed by how many of the newest to list
+ * @return 0 on success, 1 for a bad count
+ */
+int do_history(char **argv)
+{
+	size_t count = SIZE_MAX;
+	if (argv[1] != NULL)
+	{
+		char *end;
+		long n = strtol(argv[1], &end, 10);
+		if (end == argv[1] || *end != '\0' || n < 0)
+		{
+			report("history: %s: numeric argument required\n", argv[1]);
+			return 1;
+		}
+		count = n;
+	}
+	if (fd < 0)
+		return 0;
+	if (!is_current())
+		open_file();
+	remap();
+	index_records();
+	size_t first = count < nentries ? nentries - count : 0;
+	for (size_t i = first; i < nentries; i++)
+	{
+		const char *record = map + offsets[i];
+		printf("%5zu  %.*s\n", i + 1, (int)load_u32(record + 4), record + HEADER_SIZE);
+	}
+	return 0;
+}
@@ -0,0 +1,14 @@
+// history.h: Command history, shared by all the shells of a user
+
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <stddef.h>
+
+void history_init(void);
+void history_collect(const char *line, size_t len);
+void history_discard(void);
+void history_add(void);
+int do_history(char **argv);
+
+#endif
@@ -1,9 +1,23 @@
 // jobs.c:  Manipulate jobs
 // Created by Mack Oct.1 2022
 
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#endif
+#ifndef _DEFAULT_SOURCE
+#define _DEFAULT_SOURCE 1
+#endif
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/wait.h>
 #include "jobs.h"
+#include "timing.h"
+#include "jobslot.h"
+
+#define JOBS_INITIAL_SLOTS 16
+#define JOBS_INITIAL_PIDS 64
 
 void init_task(Task *task)
 {
@@ -11,95 +25,140 @@ void init_task(Task *task)
 	task->pid = 0;
 	task->srcfd = 0; // defaults to stdin
 	task->dstfd = 1; // defaults to stdout
-	task->argv = calloc(sizeof(char *), 512);
+	task->cmd = NULL;
+	task->argv = NULL;
+	task->assigns = NULL;
+	task->exit_code = 0;
+	memset(&task->rusage, 0, sizeof(task->rusage));
+	task->job = NULL;
 	task->prev = NULL;
 	task->next = NULL;
 }
 
-void append_task(Task *task, Task *tasks)
+void append_task(Task *task, Job *job)
 {
-	if (tasks == NULL)
-	{
-		tasks = task;
-		return;
-	}
-	Task *tmp = tasks;
-	while (tmp->next != NULL)
-		tmp = tmp->next;
+	Task *tmp = job->last_task;
 	tmp->next = task;
 	task->taskid = tmp->taskid + 1;
 	task->prev = tmp;
 	task->srcfd = task->prev->dstfd + 1;
 	task->dstfd = task->srcfd + 1;
+	task->job = job;
+	job->last_task = task;
 }
 
-void free_argv(char **argv)
+static size_t pid_hash(pid_t pid, size_t cap)
 {
-	int i = 0;
-	while (argv[i] != 0)
-	{
-		free(argv[i]);
-		i++;
-	}
+	return ((size_t)pid * 2654435761u) & (cap - 1);
 }
 
-void clean_tasks(Task *tasks)
+// the slot holding pid, or the free slot where it would go
+static PidSlot *pid_slot(PidSlot *pids, size_t cap, pid_t pid)
 {
-	if (tasks == NULL)
+	size_t i = pid_hash(pid, cap);
+	while (pids[i].pid != 0 && pids[i].pid != pid)
+		i = (i + 1) & (cap - 1);
+	return &pids[i];
+}
+
+static int grow_pids(JobTable *jobs)
+{
+	size_t cap = jobs->pid_cap * 2;
+	PidSlot *pids = calloc(cap, sizeof(PidSlot));
+	if (pids == NULL)
+		return -1;
+	for (size_t i = 0; i < jobs->pid_cap; i++)
+		if (jobs->pids[i].pid != 0)
+			*pid_slot(pids, cap, jobs->pids[i].pid) = jobs->pids[i];
+	free(jobs->pids);
+	jobs->pids = pids;
+	jobs->pid_cap = cap;
+	return 0;
+}
+
+// linear probing without tombstones: later entries of the run move back into the hole
+static void remove_pid(JobTable *jobs, Task *task)
+{
+	PidSlot *pids = jobs->pids;
+	size_t mask = jobs->pid_cap - 1;
+	size_t hole = pid_slot(pids, jobs->pid_cap, task->pid) - pids;
+	if (pids[hole].task != task)
 		return;
-	Task *tmp = tasks;
-	while (tmp->next != NULL)
-		tmp = tmp->next;
-	while (tmp->prev != NULL)
+	for (size_t i = (hole + 1) & mask; pids[i].pid != 0; i = (i + 1) & mask)
 	{
-		tmp = tmp->prev;
-		free_argv(tmp->next->argv);
-		free(tmp->next->argv);
-		free(tmp->next);
+		size_t home = pid_hash(pids[i].pid, jobs->pid_cap);
+		// the entry may move unless its home lies between the hole and itself
+		if ((i > hole && (home <= hole || home > i)) || (i < hole && home <= hole && home > i))
+		{
+			pids[hole] = pids[i];
+			hole = i;
+		}
 	}
-	free_argv(tmp->argv);
-	free(tmp->argv);
-	free(tmp);
-	tasks = NULL;
+	pids[hole].pid = 0;
+	pids[hole].task = NULL;
+	jobs->npids--;
 }
 
-/**
- * The function name is self-explainatory.
- * @param job: the job to be initialized
- */
-void init_job(Job *job)
+// a job allocated in the given arena, which it holds a reference to
+static Job *init_job(Arena *arena)
 {
+	Job *job = arena_alloc(arena, sizeof(Job));
 	job->jobid = 0;
 	job->chldcnt = 0;
-	job->cmdline = malloc(1024 * sizeof(char));
+	job->cmdline = "";
 	job->pgid = 0;
-	job->tasks = malloc(sizeof(Task));
+	job->arena = arena;
+	job->pipeline = NULL;
+	job->parser = NULL;
+	job->tasks = arena_alloc(arena, sizeof(Task));
 	init_task(job->tasks);
+	job->tasks->job = job;
+	job->last_task = job->tasks;
 	job->status = 1;
-	job->prev = NULL;
-	job->next = NULL;
+	job->prev_done = NULL;
+	job->next_done = NULL;
 	job->background = 0;
+	job->queued = 0;
+	job->slot = 0;
+	job->prev_queued = NULL;
+	job->next_queued = NULL;
+	job->next_listed = NULL;
+	return job;
 }
 
 /**
- * Add a job to the job list
- * @param new_job the job to be added
- * @param jobs the job list
+ * Allocate a new job inside a fresh arena and initialize it.
+ * The job, its tasks and its command line are all released by free_job().
+ * @return the new job
  */
-int add_job(Job *new_job, Job *jobs)
+Job *create_job(void)
 {
-	if (jobs == NULL)
-	{
-		jobs = new_job;
-		return 0;
-	}
-	Job *tmp = jobs;
-	while (tmp->next != NULL)
-		tmp = tmp->next;
-	tmp->next = new_job;
-	new_job->prev = tmp;
-	new_job->jobid = tmp->jobid + 1;
-	return 0;
+	return init_job(arena_create());
+}
+
+/**
+ * Allocate a job for another pipeline of the same command line. It lives in
+ * the arena of the line's first job, next to the syntax tree, and the arena
+ * stays until both are freed.
+ * @param first the job parse() was given
+ * @return the new job
+ */
+Job *create_listed_job(Job *first)
+{
+	arena_retain(first->arena);
+	return init_job(first->arena);
+}
+
+/**
+ * Release a job and everything allocated for it in one go.
+ * The job must not be in the job table, see remove_job().
+ * @param job the job to be released
+ */
+void free_job(Job *job)
+{
+	if (job == NULL)
+		return;
+	arena_destroy(job->arena);
 }
 
 /**
@@ -107,141 +166,350 @@ int add_job(Job *new_job, Job *jobs)
  * @param job the job to which the task is added
  * @return aforementioned pointer
  */
-Task *add_task(Job *jobs)
+Task *add_task(Job *job)
 {
-	if (jobs == NULL)
+	if (job == NULL)
 		return NULL;
-	Job *tmp = jobs;
-	while (tmp->next != NULL)
-		tmp = tmp->next;
-	Task *task = malloc(sizeof(Task));
+	Task *task = arena_alloc(job->arena, sizeof(Task));
 	init_task(task);
-	append_task(task, tmp->tasks);
+	append_task(task, job);
+	return task;
+}
+
+/**
+ * Create an empty job table.
+ * @return the table
+ */
+JobTable *create_job_table(void)
+{
+	JobTable *jobs = calloc(1, sizeof(JobTable));
+	jobs->nslots = JOBS_INITIAL_SLOTS;
+	jobs->slots = calloc(jobs->nslots, sizeof(Job *));
+	jobs->pid_cap = JOBS_INITIAL_PIDS;
+	jobs->pids = calloc(jobs->pid_cap, sizeof(PidSlot));
+	return jobs;
+}
+
+/**
+ * Release the table and every job still in it.
+ * Only call this function when the shell is exiting
+ * @param jobs the job table
+ */
+void free_job_table(JobTable *jobs)
+{
+	for (int i = 1; i <= jobs->max_jobid; i++)
+		free_job(jobs->slots[i]);
+	free(jobs->slots);
+	free(jobs->pids);
+	free(jobs);
+}
+
+/**
+ * Add a job to the job table, giving it the next job id
+ * @param new_job the job to be added
+ * @param jobs the job table
+ */
+int add_job(Job *new_job, JobTable *jobs)
+{
+	int jobid = jobs->max_jobid + 1;
+	if (jobid >= jobs->nslots)
+	{
+		Job **slots = realloc(jobs->slots, jobs->nslots * 2 * sizeof(Job *));
+		if (slots == NULL)
+			return -1;
+		memset(slots + jobs->nslots, 0, jobs->nslots * sizeof(Job *));
+		jobs->slots = slots;
+		jobs->nslots *= 2;
+	}
+	jobs->slots[jobid] = new_job;
+	jobs->max_jobid = jobid;
+	new_job->jobid = jobid;
+	return 0;
+}
+
+// put a finished background job at the end of the queue to be announced
+static void push_done(JobTable *jobs, Job *job)
+{
+	job->prev_done = jobs->last_done;
+	job->next_done = NULL;
+	if (jobs->last_done != NULL)
+		jobs->last_done->next_done = job;
+	else
+		jobs->done = job;
+	jobs->last_done = job;
+}
+
+// take a job out of the queue to be announced, if it is there
+static void unlink_done(JobTable *jobs, Job *job)
+{
+	if (job->prev_done == NULL && jobs->done != job)
+		return;
+	if (job->prev_done != NULL)
+		job->prev_done->next_done = job->next_done;
+	else
+		jobs->done = job->next_done;
+	if (job->next_done != NULL)
+		job->next_done->prev_done = job->prev_done;
+	else
+		jobs->last_done = job->prev_done;
+	job->prev_done = NULL;
+	job->next_done = NULL;
+}
+
+/**
+ * Put a background job at the end of the queue of jobs waiting for a job slot.
+ * @param jobs the job table
+ * @param job the job
+ */
+void queue_job(JobTable *jobs, Job *job)
+{
+	job->prev_queued = jobs->last_queued;
+	job->next_queued = NULL;
+	if (jobs->last_queued != NULL)
+		jobs->last_queued->next_queued = job;
+	else
+		jobs->queue = job;
+	jobs->last_queued = job;
+}
+
+/**
+ * Take a job out of the queue of jobs waiting for a job slot, if it is there.
+ * @param jobs the job table
+ * @param job the job
+ */
+void unqueue_job(JobTable *jobs, Job *job)
+{
+	if (job->prev_queued == NULL && jobs->queue != job)
+		return;
+	if (job->prev_queued != NULL)
+		job->prev_queued->next_queued = job->next_queued;
+	else
+		jobs->queue = job->next_queued;
+	if (job->next_queued != NULL)
+		job->next_queued->prev_queued = job->prev_queued;
+	else
+		jobs->last_queued = job->prev_queued;
+	job->prev_queued = NULL;
+	job->next_queued = NULL;
+}
+
+/**
+ * Take a job out of the table and release it.
+ * @param job the job
+ * @param jobs the job table
+ */
+void remove_job(Job *job, JobTable *jobs)
+{
+	for (Task *task = job->tasks; task != NULL; task = task->next)
+		if (task->pid > 0)
+			remove_pid(jobs, task);
+	// it may still wait to be announced, or for a job slot
+	unlink_done(jobs, job);
+	unqueue_job(jobs, job);
+	jobslot_release(job);
+
+	jobs->slots[job->jobid] = NULL;
+	while (jobs->max_jobid > 0 && jobs->slots[jobs->max_jobid] == NULL)
+		jobs->max_jobid--;
+	free_job(job);
+}
+
+/**
+ * Find a job by its id.
+ * @param jobs the job table
+ * @param jobid the id
+ * @return the job, or NULL if there is none
+ */
+Job *find_job(JobTable *jobs, int jobid)
+{
+	if (jobid <= 0 || jobid > jobs->max_jobid)
+		return NULL;
+	return jobs->slots[jobid];
+}
+
+/**
+ * Remember which task a started process belongs to.
+ * @param jobs the job table
+ * @param task the task, whose pid is set
+ * @return 0 on success, -1 if out of memory
+ */
+int add_pid(JobTable *jobs, Task *task)
+{
+	if ((jobs->npids + 1) * 2 > jobs->pid_cap && grow_pids(jobs) < 0)
+		return -1;
+	PidSlot *slot = pid_slot(jobs->pids, jobs->pid_cap, task->pid);
+	if (slot->pid == 0)
+		jobs->npids++;
+	slot->pid = task->pid;
+	slot->task = task;
+	return 0;
+}
+
+/**
+ * Find the task of a process.
+ * @param jobs the job table
+ * @param pid the process
+ * @return the task, or NULL if the pid is not ours
+ */
+Task *find_task(JobTable *jobs, pid_t pid)
+{
+	if (pid <= 0)
+		return NULL;
+	return pid_slot(jobs->pids, jobs->pid_cap, pid)->task;
+}
+
+// the way the shell reports a wait() status: exit code, or 128 + signal
+static int decode_status(int status)
+{
+	if (WIFEXITED(status))
+		return WEXITSTATUS(status);
+	if (WIFSIGNALED(status))
+		return 128 + WTERMSIG(status);
+	return 0;
+}
+
+/**
+ * Account for a child that has been waited for: its exit code and
+ * resource usage are kept in its task. When it was the last process of
+ * its job, the job is done; a background job is then queued for
+ * announce_jobs().
+ * @param jobs the job table
+ * @param pid what wait4() returned
+ * @param status its wait status
+ * @param rusage its resource usage
+ * @return the task of the child, or NULL if the pid is not ours
+ */
+Task *finish_task(JobTable *jobs, pid_t pid, int status, const struct rusage *rusage)
+{
+	Task *task = find_task(jobs, pid);
+	if (task == NULL)
+		return NULL;
+	task->exit_code = decode_status(status);
+	task->rusage = *rusage;
+	// the pid may be reused from now on
+	remove_pid(jobs, task);
+	Job *job = task->job;
+	if (job->chldcnt > 0 && --job->chldcnt == 0)
+	{
+		// set job to be done
+		job->status = 0;
+		if (job->pipeline != NULL && job->pipeline->timed)
+			clock_gettime(CLOCK_MONOTONIC, &job->finished);
+		if (job->background)
+		{
+			jobslot_release(job);
+			push_done(jobs, job);
+		}
+	}
 	return task;
 }
 
+/**
+ * Wait for every child that has exited, without blocking.
+ * @param jobs the job table
+ * @return number of children reaped
+ */
+int reap_children(JobTable *jobs)
+{
+	int count = 0;
+	int status;
+	struct rusage rusage;
+	pid_t pid;
+	while ((pid = wait4(-1, &status, WNOHANG, &rusage)) > 0 || (pid < 0 && errno == EINTR))
+		if (pid > 0)
+		{
+			finish_task(jobs, pid, status, &rusage);
+			count++;
+		}
+	return count;
+}
+
+/**
+ * Empty the queue of finished background jobs.
+ * @param jobs the job table
+ * @param verbose 1 to print "[n] done" for each and release it; otherwise
+ * they stay in the table until "jobs" shows them
+ * @return number of jobs announced
+ */
+int announce_jobs(JobTable *jobs, int verbose)
+{
+	int count = 0;
+	while (jobs->done != NULL)
+	{
+		Job *job = jobs->done;
+		unlink_done(jobs, job);
+		if (!verbose)
+			continue;
+		printf("[%d] done %s\n", job->jobid, job->cmdline);
+		if (job->pipeline != NULL && job->pipeline->timed)
+			report_times(job);
+		remove_job(job, jobs);
+		count++;
+	}
+	return count;
+}
+
 /**
  * This function not only "wait" (as-if) for terminated jobs
  * but also offers an option to print out who had terminated
- * @param jobs the job list
+ * @param jobs the job table
  * @param verbose 1 for printing all jobs
  */
-int clean_jobs(Job *jobs, int verbose)
+int clean_jobs(JobTable *jobs, int verbose)
 {
-	// update entry point
-	Job *saved_jobs = jobs;
-	Job *saved_entry = jobs->next;
-	// if there's only one job (job 0) do nothing
-	if (jobs->next == NULL)
-		return 0;
-	jobs = jobs->next;
-	jobs->prev = NULL;
-
-	while (jobs != NULL)
+	// the newest job is the one running us, if any
+	int self = jobs->max_jobid;
+	for (int i = 1; i <= self; i++)
 	{
-		if (jobs->status == 1)
+		Job *job = jobs->slots[i];
+		if (job == NULL)
+			continue;
+		if (job->status == 1)
 		{
 			// print running jobs if verbose (don't print ourselves)
-			if (verbose && jobs->next)
+			if (verbose && i != self)
 			{
 				printf("[");
-				printf("%d", jobs->jobid);
+				printf("%d", job->jobid);
 				printf("] ");
-				printf("running ");
-				printf("%s", jobs->cmdline);
+				printf(job->queued ? "queued " : "running ");
+				printf("%s", job->cmdline);
 				printf("\n");
 				fflush(stdout);
 			}
-			jobs = jobs->next;
 		}
 		// JOJ specifoc workaround
 		// Object-oriented programming (x) JOJ-oriented programming (o)
-		else if (verbose || (!verbose && !(jobs->background)))
+		else if (verbose || (!verbose && !(job->background)))
 		{
-			// done job needs to be cleared
-			Job *tmp = jobs;
-			if (jobs->prev != NULL)
-			{
-				jobs->prev->next = jobs->next;
-				if (jobs->next != NULL)
-					jobs->next->prev = jobs->prev;
-			}
-			else
-			{
-				saved_entry = jobs->next;
-				if (jobs->next != NULL)
-					jobs->next->prev = NULL;
-			}
-			jobs = jobs->next;
-			clean_tasks(tmp->tasks);
 			// print finished background jobs
-			if (tmp->background && verbose)
+			if (job->background && verbose)
 			{
 				printf("[");
-				printf("%d", tmp->jobid);
+				printf("%d", job->jobid);
 				printf("] ");
 				printf("done ");
-				printf("%s", tmp->cmdline);
+				printf("%s", job->cmdline);
 				printf("\n");
 				fflush(stdout);
+				if (job->pipeline != NULL && job->pipeline->timed)
+					report_times(job);
 			}
-			free(tmp->cmdline);
-			free(tmp);
+			// done job needs to be cleared
+			remove_job(job, jobs);
 		}
-		else
-			// wait for God to clean those jobs
-			// I gotta live in Bengbu
-			jobs = jobs->next;
-	}
-	if (saved_jobs->next != NULL)
-		saved_jobs->next = saved_entry;
-	return 0;
-}
-
-/**
- * This function cleans all jobs in the job list.
- * Only call this function when the shell is exiting
- * @param jobs the job list
- */
-int clean_all_jobs(Job *jobs)
-{
-	// update entry point
-	clean_tasks(jobs->tasks);
-	free(jobs->cmdline);
-	// handle ctrl-d
-	if (jobs->next)
-	{
-		jobs = jobs->next;
-		jobs->prev = NULL;
-	}
-	else
-		return 0;
-
-	if (jobs == NULL)
-		return 0;
-	Job *tmp = jobs;
-	while (tmp->next != NULL)
-		tmp = tmp->next;
-	while (tmp->prev != NULL)
-	{
-		tmp = tmp->prev;
-		clean_tasks(tmp->next->tasks);
-		free(tmp->next->cmdline);
-		free(tmp->next);
+		// else wait for God to clean those jobs
+		// I gotta live in Bengbu
 	}
-	clean_tasks(tmp->tasks);
-	free(tmp->cmdline);
-	free(tmp);
-	jobs = NULL;
 	return 0;
 }
 
 /**
  * Shell built-in "jobs" command
  * Wrapper of clean_jobs()
- * @param jobs the job list
+ * @param jobs the job table
  */
-int do_jobs(Job *jobs)
+int do_jobs(JobTable *jobs)
 {
 	return clean_jobs(jobs, 1);
 }
@@ -4,22 +4,34 @@
 #ifndef JOBS_H
 #define JOBS_H
 
+#include <time.h>
 #include <sys/types.h>
+#include <sys/resource.h>
+#include "arena.h"
+#include "ast.h"
 
 // Task structure definition. Tasks start from taskid 0.
+// Tasks are allocated from the arena of the Job they belong to.
 typedef struct _task
 {
 	int taskid;
 	pid_t pid;
 	int srcfd;
 	int dstfd;
-	char **argv;
+	Command *cmd; // syntax tree of this stage
+	char **argv;  // built from cmd by expand_task()
+	char **assigns; // NAME=value words in front of argv, NULL if there are none
+	int exit_code; // exit status, 128 + signal if killed; set once reaped
+	struct rusage rusage;
+	struct _job *job;
 	struct _task *prev;
 	struct _task *next;
 } Task;
 
-// Job structure definition. Jobs start from jobid 1;
-// Jobid 0 is reserved for the job sequence.
+// Job structure definition. Jobs start from jobid 1, and the id is the
+// job's slot in the JobTable.
+// A Job lives inside its own arena, together with everything parsed from its command line.
+// The jobs of a list ("a && b; c") share the arena of the line.
 typedef struct _job
 {
 	int jobid;
@@ -27,17 +39,70 @@ typedef struct _job
 	int background;
 	char *cmdline;
 	pid_t pgid;
+	Pipeline *pipeline;
+	struct _parser *parser; // state of an unfinished parse()
 	Task *tasks;
+	Task *last_task;
 	int status;
-	struct _job *prev;
-	struct _job *next;
+	struct timespec started; // for the "time" keyword
+	struct timespec finished;
+	Arena *arena;
+	struct _job *prev_done; // in the queue of finished background jobs
+	struct _job *next_done;
+	int queued;		// waiting for a job slot, see jobslot.c
+	int slot;		// kind of job slot it holds while it runs in the background
+	char token;		// jobserver byte it holds
+	struct _job *prev_queued;
+	struct _job *next_queued;
+	struct _job *next_listed; // next pipeline of the same command line
 } Job;
 
-void init_job(Job *job);
-int add_job(Job *new_job, Job *jobs);
+// Slot in the pid map; pid 0 marks a free slot
+typedef struct _pid_slot
+{
+	pid_t pid;
+	Task *task;
+} PidSlot;
+
+// Table of all jobs of the shell. Jobs sit in a slot array indexed by job
+// id, and started processes in an open addressing map from pid to task, so
+// finding the job of a reaped child does not depend on how many there are.
+// A new job gets the highest id in use plus one, like Bash, so ids are
+// recycled once the jobs at the top are gone.
+typedef struct _job_table
+{
+	Job **slots; // slots[jobid], slot 0 is never used
+	int nslots;
+	int max_jobid;
+	PidSlot *pids;
+	size_t npids;
+	size_t pid_cap; // power of 2
+	// background jobs that finished and have not been announced yet; both
+	// queues are doubly linked, so a job leaves them in constant time
+	Job *done;
+	Job *last_done;
+	// background jobs waiting for a job slot, oldest first
+	Job *queue;
+	Job *last_queued;
+} JobTable;
+
+Job *create_job(void);
+Job *create_listed_job(Job *first);
+void free_job(Job *job);
 Task *add_task(Job *job);
-int clean_jobs(Job *jobs, int verbose);
-int clean_all_jobs(Job *jobs);
-int do_jobs(Job *jobs);
+JobTable *create_job_table(void);
+void free_job_table(JobTable *jobs);
+int add_job(Job *new_job, JobTable *jobs);
+void remove_job(Job *job, JobTable *jobs);
+void queue_job(JobTable *jobs, Job *job);
+void unqueue_job(JobTable *jobs, Job *job);
+Job *find_job(JobTable *jobs, int jobid);
+int add_pid(JobTable *jobs, Task *task);
+Task *find_task(JobTable *jobs, pid_t pid);
+Task *finish_task(JobTable *jobs, pid_t pid, int status, const struct rusage *rusage);
+int reap_children(JobTable *jobs);
+int announce_jobs(JobTable *jobs, int verbose);
+int clean_jobs(JobTable *jobs, int verbose);
+int do_jobs(JobTable *jobs);
 
 #endif
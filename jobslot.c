@@ -0,0 +1,263 @@
+// jobslot.c: Job slots for background jobs, and the GNU make jobserver
+// A background job needs a slot to start; without one it waits in the job
+// table's queue. "set maxjobs=N" allows N at a time. The GNU make jobserver
+// hands out slots as bytes in a pipe or fifo: a client owns one implicit
+// slot, reads a byte for every other job and writes the byte back when the
+// job is done. Run by make (MAKEFLAGS has --jobserver-auth), the shell is
+// such a client. With maxjobs set and no make above us, the shell serves
+// N - 1 bytes itself and exports MAKEFLAGS, so a make started from the shell
+// draws from the same budget as the shell's own background jobs.
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "jobslot.h"
+#include "var.h"
+#include "report.h"
+
+// what a job holds, in Job.slot
+#define SLOT_NONE 0
+#define SLOT_COUNTED 1	// counted against maxjobs only
+#define SLOT_IMPLICIT 2 // the jobserver slot every client owns
+#define SLOT_TOKEN 3	// a byte read from the jobserver, in Job.token
+
+static int maxjobs = 0; // 0 for no limit
+static int running = 0; // background jobs holding a slot
+static int implicit_used = 0;
+static int tokens = 0; // jobserver bytes held
+
+// jobserver: our own non-blocking description of its read side, and its write side
+static int token_read = -1;
+static int token_write = -1;
+// set when we serve the jobserver: the pipe our children inherit, and the
+// MAKEFLAGS to put back when we stop
+static int served[2] = {-1, -1};
+static char *saved_makeflags = NULL;
+
+/**
+ * Open the read side of the jobserver once more, non-blocking. Setting
+ * O_NONBLOCK on the inherited fd would change it for make as well.
+ */
+static int open_reader(int fd)
+{
+	char path[32];
+	snprintf(path, sizeof(path), "/proc/self/fd/%d", fd);
+	return open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+}
+
+/**
+ * Join the jobserver of the make that started us, if any. The last
+ * --jobserver-auth (or the older --jobserver-fds) in MAKEFLAGS counts; it is
+ * either "fifo:PATH" (make 4.4) or "R,W", two fds we inherited.
+ */
+void jobslot_init(void)
+{
+	const char *flags = var_get("MAKEFLAGS");
+	if (flags == NULL)
+		return;
+	const char *auth = NULL;
+	for (const char *s = flags; (s = strstr(s, "--jobserver-")) != NULL; s++)
+		if (strncmp(s, "--jobserver-auth=", 17) == 0 || strncmp(s, "--jobserver-fds=", 16) == 0)
+			auth = strchr(s, '=') + 1;
+	if (auth == NULL)
+		return;
+	size_t len = strcspn(auth, " ");
+	if (strncmp(auth, "fifo:", 5) == 0)
+	{
+		char *path = strndup(auth + 5, len - 5);
+		token_read = open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+		if (token_read >= 0)
+			token_write = open(path, O_WRONLY | O_CLOEXEC);
+		free(path);
+	}
+	else
+	{
+		int r, w;
+		// make leaves the fds closed for commands it does not treat as recursive
+		if (sscanf(auth, "%d,%d", &r, &w) == 2 && fcntl(r, F_GETFD) >= 0 && fcntl(w, F_GETFD) >= 0)
+		{
+			token_read = open_reader(r);
+			token_write = w;
+		}
+	}
+	if (token_read < 0 || token_write < 0)
+	{
+		if (token_read >= 0)
+			close(token_read);
+		token_read = token_write = -1;
+	}
+}
+
+// MAKEFLAGS without any -j or jobserver option, which we are about to replace
+static char *strip_makeflags(const char *flags)
+{
+	char *out = malloc(strlen(flags) + 1);
+	char *dest = out;
+	while (*flags)
+	{
+		size_t len = strcspn(flags, " ");
+		if (len > 0 && strncmp(flags, "-j", 2) != 0 && strncmp(flags, "--jobserver-", 12) != 0)
+		{
+			if (dest != out)
+				*dest++ = ' ';
+			memcpy(dest, flags, len);
+			dest += len;
+		}
+		flags += len;
+		while (*flags == ' ')
+			flags++;
+	}
+	*dest = '\0';
+	return out;
+}
+
+static void stop_serving(void)
+{
+	if (served[0] < 0)
+		return;
+	close(served[0]);
+	close(served[1]);
+	close(token_read);
+	served[0] = served[1] = token_read = token_write = -1;
+	if (saved_makeflags != NULL)
+		var_set("MAKEFLAGS", saved_makeflags, 1);
+	else
+		var_unset("MAKEFLAGS");
+	free(saved_makeflags);
+	saved_makeflags = NULL;
+}
+
+// a pipe of n - 1 tokens; the fds are left open across exec for make to find
+static int start_serving(int n)
+{
+	if (pipe(served) < 0)
+		return -1;
+	token_read = open_reader(served[0]);
+	token_write = served[1];
+	for (int i = 0; i < n - 1; i++)
+		if (write(token_write, "+", 1) != 1)
+			break;
+	const char *flags = var_get("MAKEFLAGS");
+	saved_makeflags = flags != NULL ? strdup(flags) : NULL;
+	char *rest = strip_makeflags(flags != NULL ? flags : "");
+	char *value;
+	// the form make itself exports, with a leading space when there are no other flags
+	if (asprintf(&value, "%s -j%d --jobserver-auth=%d,%d", rest, n, served[0], served[1]) >= 0)
+	{
+		var_set("MAKEFLAGS", value, 1);
+		free(value);
+	}
+	free(rest);
+	return 0;
+}
+
+/**
+ * Set the limit from "set maxjobs=N". Under make's jobserver the limit only
+ * adds to it; otherwise N > 1 also makes the shell serve a jobserver.
+ * @param value N, 0 for no limit
+ * @return 0 on success, -1 for a bad value, -2 while jobs hold our slots
+ */
+int jobslot_set(const char *value)
+{
+	char *end;
+	long n = strtol(value, &end, 10);
+	if (end == value || *end != '\0' || n < 0 || n > 4096)
+		return -1;
+	// the bytes they hold belong to the pipe we would close
+	if (served[0] >= 0 && running > 0)
+	{
+		report("set: maxjobs: wait for the background jobs first\n");
+		return -2;
+	}
+	stop_serving();
+	maxjobs = n;
+	if (maxjobs > 1 && token_read < 0)
+		start_serving(maxjobs);
+	return 0;
+}
+
+// print the setting the way "set" takes it
+void jobslot_show(void)
+{
+	printf("maxjobs=%d\n", maxjobs);
+}
+
+/**
+ * Take a slot for a background job that is about to start.
+ * @param job the job, which remembers what it took
+ * @return 1 if it may start, 0 if it has to wait
+ */
+int jobslot_acquire(Job *job)
+{
+	if (job->slot != SLOT_NONE)
+		return 1;
+	if (maxjobs > 0 && running >= maxjobs)
+		return 0;
+	if (token_read < 0)
+		job->slot = SLOT_COUNTED;
+	else if (!implicit_used)
+	{
+		implicit_used = 1;
+		job->slot = SLOT_IMPLICIT;
+	}
+	else
+	{
+		ssize_t n;
+		do
+			n = read(token_read, &job->token, 1);
+		while (n < 0 && errno == EINTR);
+		if (n != 1)
+			return 0;
+		job->slot = SLOT_TOKEN;
+		tokens++;
+	}
+	running++;
+	return 1;
+}
+
+/**
+ * Give back the slot of a job that is done, or that never started anything.
+ * @param job the job
+ */
+void jobslot_release(Job *job)
+{
+	if (job->slot == SLOT_NONE)
+		return;
+	if (job->slot == SLOT_TOKEN)
+	{
+		while (write(token_write, &job->token, 1) < 0 && errno == EINTR)
+			;
+		tokens--;
+	}
+	else if (job->slot == SLOT_IMPLICIT)
+		implicit_used = 0;
+	job->slot = SLOT_NONE;
+	running--;
+}
+
+/**
+ * The fd to poll while jobs wait for a slot: readable when a jobserver byte
+ * may be free. -1 when only a job finishing can help.
+ */
+int jobslot_fd(void)
+{
+	if (token_read < 0 || !implicit_used || (maxjobs > 0 && running >= maxjobs))
+		return -1;
+	return token_read;
+}
+
+/**
+ * Tell whether jobs hold bytes of a make's jobserver. The shell must not exit
+ * before they are back, or make would find them missing.
+ * @return number of bytes held, 0 when we serve the jobserver ourselves
+ */
+int jobslot_borrowed(void)
+{
+	return served[0] < 0 ? tokens : 0;
+}
@@ -0,0 +1,16 @@
+// jobslot.h: Job slots for background jobs, and the GNU make jobserver
+
+#ifndef JOBSLOT_H
+#define JOBSLOT_H
+
+#include "jobs.h"
+
+void jobslot_init(void);
+int jobslot_set(const char *value);
+void jobslot_show(void);
+int jobslot_acquire(Job *job);
+void jobslot_release(Job *job);
+int jobslot_fd(void);
+int jobslot_borrowed(void);
+
+#endif
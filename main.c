@@ -13,10 +13,20 @@
 #include <unistd.h>
 #include <string.h>
 #include <signal.h>
+#include <fcntl.h>
+#include <poll.h>
 #include <sys/types.h>
+#include <sys/signalfd.h>
 #include "parse.h"
+#include "reader.h"
+#include "spawn.h"
 #include "execute.h"
 #include "jobs.h"
+#include "trace.h"
+#include "jobslot.h"
+#include "var.h"
+#include "history.h"
+#include "report.h"
 
 // error code
 // we have: duplicate redir (d), no program (m), and grammar error (designated) for this
@@ -25,258 +35,257 @@
 // we only report what we think that "we cannot continue to execute()" here
 volatile int error_parsing = 0;
 
-// not quite into global variables especially global pointers, but have to
-Job *current_job = NULL;
-Job *global_jobs_ptr = NULL;
+// 1 when reading commands from a terminal: prompts and job control are only for humans
+int interactive = 0;
 
-// signal handler. deals: SIGINT and SIGCHLD
-void sig_handler(int signo, siginfo_t *siginfo, void *context);
+extern char **environ;
 
-int main()
+// what read_signals() found in the signalfd
+#define GOT_SIGCHLD 1
+#define GOT_SIGINT 2
+
+/**
+ * Drain the signalfd. SIGCHLD and SIGINT are blocked and only ever
+ * delivered through it, so nothing runs in signal context.
+ * @param sigfd the signalfd
+ * @return GOT_SIGCHLD and GOT_SIGINT, OR'd
+ */
+static int read_signals(int sigfd)
+{
+	int got = 0;
+	struct signalfd_siginfo info;
+	while (read(sigfd, &info, sizeof(info)) == sizeof(info))
+	{
+		if (info.ssi_signo == SIGCHLD)
+			got |= GOT_SIGCHLD;
+		else if (info.ssi_signo == SIGINT)
+			got |= GOT_SIGINT;
+	}
+	return got;
+}
+
+int main(int argc, char *argv[])
 {
 	// disable stdout buffering
 	setbuf(stdout, NULL);
 
-	// set pgroup
-	setpgid(getpid(), getpid());
-	tcsetpgrp(STDIN_FILENO, getpgrp());
+	// where do commands come from: "-c string", a script, or stdin
+	Reader *reader = NULL;
+	if (argc > 1 && strcmp(argv[1], "-c") == 0)
+	{
+		if (argc < 3)
+		{
+			fprintf(stderr, "mumsh: -c: option requires an argument\n");
+			return 2;
+		}
+		reader = reader_from_string(argv[2]);
+	}
+	else if (argc > 1)
+	{
+		int fd = open(argv[1], O_RDONLY);
+		if (fd < 0)
+		{
+			fprintf(stderr, "mumsh: %s: No such file or directory\n", argv[1]);
+			return 127;
+		}
+		// commands we run shouldn't inherit the script
+		fcntl(fd, F_SETFD, FD_CLOEXEC);
+		reader = reader_open(fd);
+	}
+	else
+	{
+		interactive = isatty(STDIN_FILENO);
+		reader = reader_open(STDIN_FILENO);
+	}
 
-	// signal handling
-	struct sigaction sigint_act;
-	sigint_act.sa_sigaction = sig_handler;
-	sigint_act.sa_flags = SA_SIGINFO | SA_RESTART; // AFAIC all POSIX systems are safe to use SA_RESTART
-	sigaction(SIGINT, &sigint_act, NULL);
-	sigaction(SIGCHLD, &sigint_act, NULL);
+	// how external commands are started: fork, vfork or posix_spawn
+	char *backend = getenv("MUMSH_SPAWN");
+	if (backend != NULL && spawn_backend_by_name(backend) >= 0)
+		spawn_backend = spawn_backend_by_name(backend);
+
+	// where spans of our own work go, if anywhere
+	char *trace = getenv("MUMSH_TRACE");
+	if (trace != NULL && *trace != '\0' && trace_open(trace) < 0)
+		fprintf(stderr, "mumsh: %s: cannot open trace file\n", trace);
+
+	// variables start out as the environment we were given
+	var_init(environ);
+
+	// share the job slots of the make that runs us, if it does
+	jobslot_init();
+
+	if (interactive)
+	{
+		// lines typed at the prompt go into the shared history file
+		history_init();
+		// set pgroup
+		setpgid(getpid(), getpid());
+		tcsetpgrp(STDIN_FILENO, getpgrp());
+	}
+
+	// signal handling: SIGINT (for a terminal) and SIGCHLD are read from a
+	// signalfd by the main loop; children get an empty mask back
+	sigset_t sigmask;
+	sigemptyset(&sigmask);
+	sigaddset(&sigmask, SIGCHLD);
+	if (interactive)
+		sigaddset(&sigmask, SIGINT);
+	sigprocmask(SIG_BLOCK, &sigmask, NULL);
+	int sigfd = signalfd(-1, &sigmask, SFD_NONBLOCK | SFD_CLOEXEC);
 	signal(SIGTTOU, SIG_IGN);
 
 	int return_code = 0;
-	// issue a job sequence and initilize it
-	Job *jobs = malloc(sizeof(Job));
-	init_job(jobs); // this job has jobid 0, meaning it won't be executed
-	global_jobs_ptr = jobs;
+	// issue a job table and initilize it
+	JobTable *jobs = create_job_table();
 
-	// instruction and storage for incremental parsing
-	int incremental_parse = 0;
-	char *cmdline_save = calloc(sizeof(char), 1026);
+	// job whose command line is still incomplete; parse() resumes it with the next line
+	Job *new_job = NULL;
 
 	// Exciting! Main RPEL!
 	do
 	{
-		char *cmdline = calloc(sizeof(char), 1026);
+		// reap what exited while the last command ran; a ^C meant for it is stale
+		TRACE_BEGIN(reap_start);
+		read_signals(sigfd);
+		reap_children(jobs);
+		start_queued(jobs);
+		announce_jobs(jobs, interactive);
+		TRACE_END(reap_start, "reap", 0);
 
 		// Print prompt
-		if (incremental_parse)
-			printf("> ");
-		else
-			printf("mumsh $ ");
+		if (interactive)
+			printf(new_job ? "> " : "mumsh $ ");
+
+		// wait for a whole line, handling children and ^C as they come
+		TRACE_BEGIN(read_start);
+		while (!reader_ready(reader))
+		{
+			// queued background jobs also wait for a byte from the jobserver
+			int slotfd = jobs->queue != NULL ? jobslot_fd() : -1;
+			struct pollfd fds[3] = {{reader->fd, POLLIN, 0}, {sigfd, POLLIN, 0}, {slotfd, POLLIN, 0}};
+			if (poll(fds, 3, -1) < 0)
+			{
+				if (errno == EINTR)
+					continue;
+				break;
+			}
+			if (fds[0].revents && reader_fill(reader) < 0)
+				break;
+			if (fds[1].revents & POLLIN)
+			{
+				int got = read_signals(sigfd);
+				if (got & GOT_SIGINT)
+				{
+					// drop the line being typed, like Bash
+					printf("\n");
+					free_job(new_job);
+					new_job = NULL;
+					history_discard();
+					printf("mumsh $ ");
+				}
+				if (got & GOT_SIGCHLD)
+				{
+					reap_children(jobs);
+					start_queued(jobs);
+					// background jobs are announced right away, then the prompt again;
+					// if a line is already in, they wait for the next prompt
+					if (interactive && !reader_ready(reader) && jobs->done != NULL)
+					{
+						printf("\n");
+						announce_jobs(jobs, 1);
+						printf(new_job ? "> " : "mumsh $ ");
+					}
+				}
+			}
+			if (fds[2].revents & POLLIN)
+				start_queued(jobs);
+		}
 
 		// Read command line
-		fgets(cmdline, 1025, stdin);
+		char *cmdline = NULL;
+		ssize_t len = reader_getline(reader, &cmdline);
+		TRACE_END(read_start, "read", 0);
 
 		// handle Ctrl-D
-		if (feof(stdin))
+		if (len <= 0)
 		{
-			printf("exit\n");
-			free(cmdline);
+			if (interactive)
+				printf("exit\n");
+			// an open quote, a trailing && or | or a here-document never ended
+			if (new_job != NULL)
+			{
+				report("syntax error: unexpected end of file\n");
+				last_status = 2;
+			}
+			free_job(new_job);
 			break;
 		}
 		// handle no input
-		if (strlen(cmdline) == 1 && cmdline[0] == '\n')
+		if (new_job == NULL && len == 1)
 		{
 			// "wait" for finished jobs
 			clean_jobs(jobs, 0);
-			free(cmdline);
 			continue;
 		}
-		
-		// do strcat
-		if (incremental_parse)
-		{
-			char *temp = malloc(1026 * sizeof(char));
-			strcpy(temp, cmdline_save);
-			strcat(temp, cmdline);
-			memset(cmdline, 0, 1026);
-			strcpy(cmdline, temp);
-			free(temp);
-		}
-		// for the sake of parse()
-		int str_len = (int)strlen(cmdline); // prevent heap buffer overflow on empty input
-		cmdline[str_len - 1] = ' ';
-		cmdline[str_len] = -1;
-
-		// no error, reset incremental_parse
-		incremental_parse = 0;
 
 		// Parse Input
-		Job *new_job = malloc(sizeof(Job));
-		init_job(new_job);
-		return_code = parse(cmdline, new_job);
-		// restore cmdline state after parse() succeeds
-		cmdline[str_len - 1] = 0;
-		cmdline[str_len] = 0;
+		if (new_job == NULL)
+			new_job = create_job();
+		if (interactive)
+			history_collect(cmdline, len);
+		TRACE_BEGIN(parse_start);
+		return_code = parse(cmdline, len, new_job);
+		TRACE_END(parse_start, "parse", 0);
 		// issue corresponding error message to stderr
 		if (error_parsing)
 		{
-			switch (error_parsing)
-			{
-			case '<':
-				printf("syntax error near unexpected token `<'\n");
-				clean_all_jobs(new_job);
-				free(new_job);
-				free(cmdline);
-				break;
-			case '>':
-				printf("syntax error near unexpected token `>'\n");
-				clean_all_jobs(new_job);
-				free(new_job);
-				free(cmdline);
-				break;
-			case '|':
-				printf("syntax error near unexpected token `|'\n");
-				clean_all_jobs(new_job);
-				free(new_job);
-				free(cmdline);
-				break;
-			case 'i':
-				printf("error: duplicated input redirection\n");
-				clean_all_jobs(new_job);
-				free(new_job);
-				free(cmdline);
-				break;
-			case 'o':
-				printf("error: duplicated output redirection\n");
-				clean_all_jobs(new_job);
-				free(new_job);
-				free(cmdline);
-				break;
-			case 'm':
-				printf("error: missing program\n");
-				clean_all_jobs(new_job);
-				free(new_job);
-				free(cmdline);
-				break;
-			default:
-				break;
-			}
+			// a line that was wrong is still worth getting back
+			if (interactive)
+				history_add();
+			print_parse_error(error_parsing);
+			free_job(new_job);
+			new_job = NULL;
 			error_parsing = 0;
 			continue;
 		}
+		// encountered incomplete input, keep the job and its parser state
 		if (return_code != 0)
-		{
-			// encountered incomplete input
-			clean_all_jobs(new_job);
-			free(new_job);
-			// save command line
-			incremental_parse = 1;
-			if (return_code <= 3)
-				// in quote, retain "original" cmdline
-				cmdline[str_len - 1] = '\n';
-			strcpy(cmdline_save, cmdline);
-			free(cmdline);
-			error_parsing = 0;
 			continue;
-		}
-
-		// add new job to job list
-		add_job(new_job, jobs);
 
 		// All Safe, Execute Command
 		error_parsing = 0;
-		current_job = new_job;
-		return_code = execute(new_job, jobs);
-		current_job = NULL;
-
-		clean_jobs(jobs, 0);
+		Job *current_job = new_job;
+		new_job = NULL;
+		if (interactive)
+			history_add();
+		// let commands reading stdin start right after this line
+		reader_sync(reader);
+		return_code = execute_list(current_job, jobs);
+		reader_resync(reader);
 
-		// cleanup
-		free(cmdline);
 		if (return_code == 114514)
 			// exit
 			break;
 	} while (1);
 
-	// cleanup
-	clean_all_jobs(jobs);
-	free(jobs);
-	free(cmdline_save);
-	if (return_code == 114514)
-		return_code = 0;
-	return return_code;
-}
-
-void sig_handler(int signo, siginfo_t *siginfo, void *context)
-{
-	// suppress compiler warning
-	while (context)
-		break;
-	// handle Ctrl-C
-	if (signo == SIGINT)
+	// a script's background jobs still waiting for a slot run before we go, and
+	// those running on a make's jobserver bytes are waited for
+	while (!interactive)
 	{
-		if (current_job)
-		{
-			// kill all processes in current job
-			killpg(current_job->pgid, SIGINT);
-			// set job status to stopped
-			current_job->status = 0;
-			// set errno to 0 (prevent another exit)
-			errno = 0;
-		}
-		else
-		{
-			// print new prompt
-			// this is default behavior of Bash
-			printf("\n");
-			// "wait" for finished jobs
-			clean_jobs(global_jobs_ptr, 0);
-			printf("mumsh $ ");
-		}
+		reap_children(jobs);
+		start_queued(jobs);
+		if (jobs->queue == NULL && jobslot_borrowed() == 0)
+			break;
+		struct pollfd fds[2] = {{sigfd, POLLIN, 0}, {jobslot_fd(), POLLIN, 0}};
+		if (poll(fds, 2, -1) < 0 && errno != EINTR)
+			break;
+		read_signals(sigfd);
 	}
-	// handle SIGCHLD when there's some background job
-	else if (signo == SIGCHLD && current_job == NULL)
-	{
-		// only return if the last process in the job has exited
-		// so we find the last process in every jobs
-		pid_t target_pid = siginfo->si_pid;
-
-		// !! THIS IS UGLY DO NOT TRY TO COPY ME !!
-		// I JUST DON'T WANNA MAINTAIN YET ANOTHER GLOBAL ARRAY
-		Job *tmp = global_jobs_ptr;
-		global_jobs_ptr = global_jobs_ptr->next;
-		if (global_jobs_ptr == NULL)
-		{
-			global_jobs_ptr = tmp;
-			return;
-		}
-		do
-		{
-			int brk = 0;
-			Task *temp = global_jobs_ptr->tasks;
-			while (global_jobs_ptr->tasks != NULL)
-			{
-				if (global_jobs_ptr->tasks->pid == target_pid)
-				{
-					global_jobs_ptr->chldcnt--;
-					if (global_jobs_ptr->chldcnt == 0)
-					{
-						brk = 0;
-						// set job to be done
-						global_jobs_ptr->status = 0;
-						// restore current task ptr
-						global_jobs_ptr->tasks = temp;
-						break;
-					}
-				}
-				global_jobs_ptr->tasks = global_jobs_ptr->tasks->next;
-			}
-			global_jobs_ptr->tasks = temp;
-			global_jobs_ptr = global_jobs_ptr->next;
-			if (brk == 0)
-				break;
-		} while (global_jobs_ptr->next != NULL);
-		// restore global_jobs_ptr
-		global_jobs_ptr = tmp;
 
-		// !! END VERY UGLY PART !!
-	}
-	return;
+	// cleanup
+	free_job_table(jobs);
+	reader_close(reader);
+	close(sigfd);
+	trace_close();
+	return last_status;
 }
@@ -0,0 +1,64 @@
+// option.c: Shell options and the "set" builtin
+// "set name=value" hands the value to the module that owns the option;
+// "set" on its own prints every option in a form it takes back.
+
+#include <stdio.h>
+#include <string.h>
+#include "option.h"
+#include "pipebuf.h"
+#include "jobslot.h"
+#include "report.h"
+
+typedef struct _option
+{
+	const char *name;
+	int (*set)(const char *value); // 0 on success, -1 for a bad value, -2 if it said why itself
+	void (*show)(void);
+} Option;
+
+static const Option options[] = {
+    {"maxjobs", jobslot_set, jobslot_show},
+    {"pipebuf", pipebuf_set, pipebuf_show},
+};
+
+/**
+ * set: change shell options, or list them with no arguments.
+ * @param argv "set" followed by name=value pairs
+ * @return 0 on success, 1 if any of them was not taken
+ */
+int do_set(char **argv)
+{
+	const size_t noptions = sizeof(options) / sizeof(options[0]);
+	if (argv[1] == NULL)
+	{
+		for (size_t i = 0; i < noptions; i++)
+			options[i].show();
+		return 0;
+	}
+	int status = 0;
+	for (int i = 1; argv[i] != NULL; i++)
+	{
+		char *eq = strchr(argv[i], '=');
+		size_t len = eq != NULL ? (size_t)(eq - argv[i]) : strlen(argv[i]);
+		const Option *option = NULL;
+		for (size_t j = 0; j < noptions; j++)
+			if (strlen(options[j].name) == len && strncmp(options[j].name, argv[i], len) == 0)
+				option = &options[j];
+		if (option == NULL)
+		{
+			report("set: %.*s: invalid option\n", (int)len, argv[i]);
+			status = 1;
+		}
+		else if (eq == NULL)
+			option->show();
+		else
+		{
+			int error = option->set(eq + 1);
+			if (error == -1)
+				report("set: %s: invalid value for %s\n", eq + 1, option->name);
+			if (error < 0)
+				status = 1;
+		}
+	}
+	return status;
+}
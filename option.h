@@ -0,0 +1,8 @@
+// option.h: Shell options and the "set" builtin
+
+#ifndef OPTION_H
+#define OPTION_H
+
+int do_set(char **argv);
+
+#endif
@@ -0,0 +1,318 @@
+// parallel.c: The "parallel" builtin
+// parallel [-j N] [--halt soon|now] command [arg...] [::: input...]
+// Runs the command once per input, at most N at a time. An input replaces
+// every "{}" of the command, or is appended when there is none. Without
+// ":::" the inputs are the lines of stdin. Each run is a Job of one Task
+// started by start_command() and reaped through the job table, so the
+// background jobs it happens to reap on the way are not lost. A run writes
+// into a memfd of its own, which is copied to stdout when it finishes, so
+// the output of two runs never interleaves.
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "parallel.h"
+#include "execute.h"
+#include "cat.h"
+#include "report.h"
+
+#define HALT_NEVER 0
+#define HALT_SOON 1 // start nothing new after a failure
+#define HALT_NOW 2  // and kill what is running
+
+typedef struct _parallel
+{
+	char **template; // the command, with "{}" in it or not
+	int ntemplate;
+	int has_braces;
+	char **inputs;
+	int ninputs;
+	int stdin_fd; // what each run reads
+	Job **running;
+	int nrunning;
+} Parallel;
+
+// the command for one input, allocated in the job's arena
+static char **build_argv(Parallel *p, const char *input, Arena *arena)
+{
+	char **argv = arena_alloc(arena, sizeof(char *) * (p->ntemplate + 2));
+	size_t input_len = strlen(input);
+	for (int i = 0; i < p->ntemplate; i++)
+	{
+		const char *word = p->template[i];
+		size_t len = strlen(word);
+		for (const char *s = strstr(word, "{}"); s != NULL; s = strstr(s + 2, "{}"))
+			len += input_len - 2;
+		char *arg = arena_alloc(arena, len + 1);
+		char *dest = arg;
+		while (*word)
+		{
+			if (word[0] == '{' && word[1] == '}')
+			{
+				memcpy(dest, input, input_len);
+				dest += input_len;
+				word += 2;
+			}
+			else
+				*dest++ = *word++;
+		}
+		argv[i] = arg;
+	}
+	int argc = p->ntemplate;
+	if (!p->has_braces)
+		argv[argc++] = arena_strndup(arena, input, input_len);
+	argv[argc] = NULL;
+	return argv;
+}
+
+/**
+ * Start the command for one input.
+ * @return the job, which may have failed to start (pid 0, exit code set)
+ */
+static Job *launch(Parallel *p, const char *input, JobTable *jobs)
+{
+	Job *job = create_job();
+	Task *task = job->tasks;
+	task->argv = build_argv(p, input, job->arena);
+	task->srcfd = p->stdin_fd;
+	task->dstfd = memfd_create("parallel", MFD_CLOEXEC);
+	if (task->dstfd < 0)
+		task->dstfd = STDOUT_FILENO;
+	start_command(task, -1);
+	if (task->pid > 0)
+	{
+		job->chldcnt = 1;
+		add_pid(jobs, task);
+	}
+	return job;
+}
+
+// hand the output of a finished run to stdout, then let it go
+static void finish(Job *job)
+{
+	Task *task = job->tasks;
+	if (task->dstfd != STDOUT_FILENO)
+	{
+		lseek(task->dstfd, 0, SEEK_SET);
+		cat_fd(task->dstfd, STDOUT_FILENO);
+		close(task->dstfd);
+	}
+	free_job(job);
+}
+
+static int read_inputs(Parallel *p)
+{
+	FILE *in = fdopen(dup(STDIN_FILENO), "r");
+	if (in == NULL)
+		return -1;
+	char *line = NULL;
+	size_t cap = 0;
+	ssize_t len;
+	int size = 0;
+	while ((len = getline(&line, &cap, in)) >= 0)
+	{
+		if (len > 0 && line[len - 1] == '\n')
+			line[len - 1] = '\0';
+		if (p->ninputs == size)
+		{
+			size = size ? size * 2 : 64;
+			p->inputs = realloc(p->inputs, sizeof(char *) * size);
+		}
+		p->inputs[p->ninputs++] = strdup(line);
+	}
+	free(line);
+	fclose(in);
+	return 0;
+}
+
+// the first failure, with --halt: start nothing more, and with "now" stop the rest
+static void halt_runs(Parallel *p, int halt)
+{
+	for (int i = 0; halt == HALT_NOW && i < p->nrunning; i++)
+		kill(p->running[i]->tasks->pid, SIGTERM);
+}
+
+static int interrupted(void)
+{
+	sigset_t pending;
+	sigpending(&pending);
+	return sigismember(&pending, SIGINT);
+}
+
+/**
+ * parallel: run a command over many inputs with a bounded number of workers.
+ * @param argv the arguments
+ * @param jobs the job table, which reaps the runs
+ * @return 0 if every run succeeded; with --halt the status of the run that
+ * failed; otherwise the number of failed runs, at most 101; 130 after ^C
+ */
+int do_parallel(char **argv, JobTable *jobs)
+{
+	long workers = sysconf(_SC_NPROCESSORS_ONLN);
+	int halt = HALT_NEVER;
+	int i = 1;
+	for (; argv[i] != NULL && argv[i][0] == '-'; i++)
+	{
+		if (strcmp(argv[i], "--") == 0)
+		{
+			i++;
+			break;
+		}
+		int jobs_option = strncmp(argv[i], "-j", 2) == 0;
+		if (!jobs_option && strcmp(argv[i], "--halt") != 0)
+		{
+			report("parallel: %s: invalid option\n", argv[i]);
+			return 2;
+		}
+		const char *option = argv[i];
+		const char *value = jobs_option && option[2] ? option + 2 : argv[++i];
+		if (value == NULL)
+		{
+			report("parallel: %s: option requires an argument\n", option);
+			return 2;
+		}
+		if (jobs_option)
+		{
+			char *end;
+			workers = strtol(value, &end, 10);
+			if (end == value || *end != '\0' || workers < 0)
+			{
+				report("parallel: %s: invalid number of jobs\n", value);
+				return 2;
+			}
+		}
+		// GNU parallel spells it "now,fail=1"; the first failure is all we look at
+		else if (strncmp(value, "now", 3) == 0 && (value[3] == '\0' || value[3] == ','))
+			halt = HALT_NOW;
+		else if (strncmp(value, "soon", 4) == 0 && (value[4] == '\0' || value[4] == ','))
+			halt = HALT_SOON;
+		else if (strcmp(value, "never") == 0)
+			halt = HALT_NEVER;
+		else
+		{
+			report("parallel: %s: invalid --halt\n", value);
+			return 2;
+		}
+	}
+
+	Parallel p = {argv + i, 0, 0, NULL, 0, STDIN_FILENO, NULL, 0};
+	while (p.template[p.ntemplate] != NULL && strcmp(p.template[p.ntemplate], ":::") != 0)
+	{
+		if (strstr(p.template[p.ntemplate], "{}") != NULL)
+			p.has_braces = 1;
+		p.ntemplate++;
+	}
+	if (p.ntemplate == 0)
+	{
+		report("parallel: missing command\n");
+		return 2;
+	}
+	int owned_inputs = 0;
+	if (p.template[p.ntemplate] != NULL)
+	{
+		p.inputs = p.template + p.ntemplate + 1;
+		while (p.inputs[p.ninputs] != NULL)
+			p.ninputs++;
+	}
+	else
+	{
+		// the shell keeps ^C for itself, a read from the terminal could not be stopped
+		if (isatty(STDIN_FILENO))
+		{
+			report("parallel: no inputs: give them after ::: or on a pipe\n");
+			return 2;
+		}
+		if (read_inputs(&p) < 0)
+		{
+			report("parallel: stdin: %s\n", strerror(errno));
+			return 2;
+		}
+		owned_inputs = 1;
+		// the runs must not eat into the inputs
+		p.stdin_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+	}
+	if (workers == 0 || workers > p.ninputs)
+		workers = p.ninputs;
+	p.running = calloc(workers > 0 ? workers : 1, sizeof(Job *));
+
+	int failed = 0;
+	int status = 0;
+	int next = 0;
+	int stop = 0;
+	int sigint = 0;
+	while (p.nrunning > 0 || (!stop && next < p.ninputs))
+	{
+		while (!stop && next < p.ninputs && p.nrunning < workers)
+		{
+			Job *job = launch(&p, p.inputs[next++], jobs);
+			if (job->tasks->pid > 0)
+			{
+				p.running[p.nrunning++] = job;
+				continue;
+			}
+			// it never started; "command not found" counts as a failure
+			if (++failed == 1)
+				status = job->tasks->exit_code;
+			finish(job);
+			if (halt != HALT_NEVER && !stop)
+			{
+				stop = 1;
+				halt_runs(&p, halt);
+			}
+		}
+		if (p.nrunning == 0)
+			break;
+
+		int wstatus;
+		struct rusage rusage;
+		pid_t pid = wait4(-1, &wstatus, 0, &rusage);
+		if (pid < 0 && errno == EINTR)
+			continue;
+		if (pid < 0)
+			break;
+		// a background job of the shell gets queued for "jobs" as usual
+		Task *task = finish_task(jobs, pid, wstatus, &rusage);
+		int k = 0;
+		while (k < p.nrunning && (task == NULL || p.running[k] != task->job))
+			k++;
+		if (k == p.nrunning)
+			continue;
+		p.running[k] = p.running[--p.nrunning];
+		if (task->exit_code != 0)
+		{
+			if (++failed == 1)
+				status = task->exit_code;
+			if (halt != HALT_NEVER && !stop)
+			{
+				stop = 1;
+				halt_runs(&p, halt);
+			}
+		}
+		finish(task->job);
+		if (interrupted())
+			stop = sigint = 1;
+	}
+
+	free(p.running);
+	if (owned_inputs)
+	{
+		for (int j = 0; j < p.ninputs; j++)
+			free(p.inputs[j]);
+		free(p.inputs);
+		close(p.stdin_fd);
+	}
+	// ^C reached the runs too, and the shell will see it once we are back
+	if (sigint)
+		return 128 + SIGINT;
+	if (halt != HALT_NEVER)
+		return status;
+	return failed > 101 ? 101 : failed;
+}
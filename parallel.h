@@ -0,0 +1,10 @@
+// parallel.h: The "parallel" builtin
+
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include "jobs.h"
+
+int do_parallel(char **argv, JobTable *jobs);
+
+#endif
@@ -6,132 +6,63 @@
 #include "parse.h"
 #include "execute.h"
 #include "jobs.h"
+#include "var.h"
+#include "report.h"
 
 extern int error_parsing;
 
-/* !! UGLY HELPER FUNCTION !! */
-int single_quote_handler(int *in_single_quote, int *in_double_quote, char **current, char **curr_token_begin,
-			 int *in_token, int *dest_mem_filled, char ***current_argv, char **dest_ptr)
+// One physical line handed to parse(), kept for rebuilding the job's cmdline
+typedef struct _chunk
 {
-	if (*in_single_quote)
-	{
-		*in_single_quote = 0;
-		**current = '\0';
-		// if nothing is quoted do nothing
-		if (*current == *curr_token_begin)
-			*curr_token_begin = *current + 1;
-		else
-		{
-			// save this token to task, don't move argv
-			// arg len: 256 chars on MS Windows is kinda "grace"
-			if (*in_token)
-				*dest_ptr = **current_argv;
-			if (*dest_mem_filled)
-				strcat(*dest_ptr, *curr_token_begin);
-			else
-			{
-				if (*in_token)
-				{
-					**current_argv = calloc(sizeof(char), 256);
-					*dest_ptr = **current_argv;
-				}
-				strcpy(*dest_ptr, *curr_token_begin);
-				*dest_mem_filled = 1;
-			}
-			**current = 39;
-			*curr_token_begin = *current + 1;
-		}
-	}
-	else if (!(*in_double_quote))
-	{
-		// begin of single quote
-		**current = 0;
-		*in_single_quote = 1;
-		// do we have dangling token?
-		if (*current - *curr_token_begin)
-		{
-			// for strcpy needs to know the length
-			if (*in_token)
-				*dest_ptr = **current_argv;
-			if (*dest_mem_filled)
-				strcat(*dest_ptr, *curr_token_begin);
-			else
-			{
-				if (*in_token)
-				{
-					**current_argv = calloc(sizeof(char), 256);
-					*dest_ptr = **current_argv;
-				}
-				strcpy(*dest_ptr, *curr_token_begin);
-				*dest_mem_filled = 1;
-			}
-		}
-		*curr_token_begin = *current + 1;
-	}
-	return 0;
-}
+	char *text;
+	size_t len;
+	struct _chunk *next;
+} Chunk;
 
-/* !! UGLY HELPER FUNCTION !! */
-int double_quote_handler(int *in_single_quote, int *in_double_quote, char **current, char **curr_token_begin,
-			 int *in_token, int *dest_mem_filled, char ***current_argv, char **dest_ptr)
+// A here-document whose body is still to come, in the lines after its command
+typedef struct _heredoc
 {
-	if (*in_double_quote)
-	{
-		*in_double_quote = 0;
-		**current = '\0';
-		// if nothing is quoted do nothing
-		if (*current == *curr_token_begin)
-			*curr_token_begin = *current + 1;
-		else
-		{
-			// save this token to task, don't move argv
-			// arg len: 256 chars on MS Windows is kinda "grace"
-			if (*in_token)
-				*dest_ptr = **current_argv;
-			if (*dest_mem_filled)
-				strcat(*dest_ptr, *curr_token_begin);
-			else
-			{
-				if (*in_token)
-				{
-					**current_argv = calloc(sizeof(char), 256);
-					*dest_ptr = **current_argv;
-				}
-				strcpy(*dest_ptr, *curr_token_begin);
-				*dest_mem_filled = 1;
-			}
-			**current = '"';
-			*curr_token_begin = *current + 1;
-		}
-	}
-	else if (!(*in_single_quote))
-	{
-		// begin of double quote
-		**current = 0;
-		*in_double_quote = 1;
-		// do we have dangling token?
-		if (*current - *curr_token_begin)
-		{
-			// for strcpy needs to know the length
-			if (*in_token)
-				*dest_ptr = **current_argv;
-			if (*dest_mem_filled)
-				strcat(*dest_ptr, *curr_token_begin);
-			else
-			{
-				if (*in_token)
-				{
-					**current_argv = calloc(sizeof(char), 256);
-					*dest_ptr = **current_argv;
-				}
-				strcpy(*dest_ptr, *curr_token_begin);
-				*dest_mem_filled = 1;
-			}
-		}
-		*curr_token_begin = *current + 1;
-	}
-	return 0;
-}
+	Word *body;
+	char *delim;
+	size_t delim_len;
+	int strip;  // "<<-": leading tabs of the body and the delimiter go
+	int quoted; // some of the delimiter was quoted: the body is taken as it is
+	struct _heredoc *next;
+} Heredoc;
+
+// Parser state. The lexer and the grammar are one state machine driven
+// character by character, so a word is scanned exactly once. The state is
+// kept in the job between calls, so a continuation line resumes where the
+// previous one stopped instead of re-parsing from the start.
+typedef struct _parser
+{
+	Arena *arena;
+	Chunk *chunks;
+	Chunk *last_chunk;
+	size_t total_len;
+	size_t offset; // of the chunk being lexed within the line
+	Pipeline *pipeline; // the last one of the list
+	Pipeline *prev_pipeline;
+	// lexer: quote we are in (0, '\'' or '"') and the word being assembled
+	int quote;
+	Word *word;
+	// grammar: current stage and what it has seen so far
+	Command *command;
+	int stage;
+	int has_inredir;
+	int has_outredir;
+	int pending_redir; // redirection operator still waiting for its file name
+	int pending_strip; // and it was "<<-"
+	int after_pipe;
+	int after_andor; // "&&" or "||" still waiting for its pipeline
+	int held; // chunk ended in '>', '&' or '|', which may still be doubled
+	// here-documents of the line, oldest first; their bodies are read once the line ends
+	Heredoc *heredocs;
+	Heredoc *last_heredoc;
+	int in_body;
+	size_t cmd_end; // where the command text stopped and the first body began
+	int error;
+} Parser;
 
 /**
  * @brief Helper function to prepare file descriptors.
@@ -145,36 +76,32 @@ int prepare_fd(char *redir, int *fd, int mode)
 	switch (mode)
 	{
 	case 1: // input redir
-		*fd = open(redir, O_RDONLY);
+		*fd = open(redir, O_RDONLY | O_CLOEXEC);
 		if (*fd == -1)
 			// we want to report error here
 			switch (errno)
 			{
 			case 1: // EPERM
-				printf("%s", redir);
-				printf(": Permission denied\n");
+				report("%s: Permission denied\n", redir);
 				break;
 			case 2: // ENOENT
-				printf("%s", redir);
-				printf(": No such file or directory\n");
+				report("%s: No such file or directory\n", redir);
 			}
 		// we don't do the actual job of dup2() or pipe() here, dispatch it to execute()
 		break;
 	case 2: // output redir
-		*fd = open(redir, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		*fd = open(redir, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
 		if (*fd == -1)
 		{
 			// the only reason why we can't write to a file is Permission denied
-			printf("%s", redir);
-			printf(": Permission denied\n");
+			report("%s: Permission denied\n", redir);
 		}
 		break;
 	case 3: // append redir
-		*fd = open(redir, O_WRONLY | O_CREAT | O_APPEND, 0644);
+		*fd = open(redir, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
 		if (*fd == -1)
 		{
-			printf("%s", redir);
-			printf(": Permission denied\n");
+			report("%s: Permission denied\n", redir);
 		}
 		break;
 	default: // error
@@ -184,547 +111,630 @@ int prepare_fd(char *redir, int *fd, int mode)
 }
 
 /**
- * @brief Command line parser.
- * Handles quotes, redirections and pipes well.
- * @param cmdline Command line
- * @param new_job Pointer to pre malloc'd job struct
- * @return 0 on success; 1 if waiting for single quote; 2 double; 4 pipe;
- * 8 input redir; 16 output; 32 append; value to be OR'd
+ * Measure the command substitution at the start of s, "$(...)" or `...`.
+ * Parentheses nest, and quotes inside are skipped over whole.
+ * @param s the text
+ * @param len its length
+ * @return length of the substitution, 0 if s does not start one, -1 if it
+ * does not end within len
  */
-int parse(char *cmdline, Job *new_job)
+ssize_t subst_len(const char *s, size_t len)
 {
-	// okay, whatever we do first prepare a backup of cmdline
-	char *cmdline_save = calloc(sizeof(char), 1026);
-	strcpy(cmdline_save, cmdline);
+	if (len >= 1 && s[0] == '`')
+	{
+		const char *end = memchr(s + 1, '`', len - 1);
+		return end != NULL ? end - s + 1 : -1;
+	}
+	if (len < 2 || s[0] != '$' || s[1] != '(')
+		return 0;
+	int depth = 0;
+	for (size_t i = 1; i < len; i++)
+	{
+		if (s[i] == '\'' || s[i] == '"' || s[i] == '`')
+		{
+			const char *end = memchr(s + i + 1, s[i], len - i - 1);
+			if (end == NULL)
+				return -1;
+			i = end - s;
+		}
+		else if (s[i] == '(')
+			depth++;
+		else if (s[i] == ')' && --depth == 0)
+			return i + 1;
+	}
+	return -1;
+}
 
-	// indicators
-	int in_token = 0;
-	if (*cmdline == '<' || *cmdline == '>' || *cmdline == '|')
-		in_token = 0;
-	int in_single_quote = 0;
-	int in_double_quote = 0;
-	int wait_for_pipe = 0;
-	int in_inredir = 0;
-	int in_outredir = 0;
-	int in_appredir = 0;
-	int in_redirected = 0;
-	int out_redirected = 0;
+// length of the double-quoted run at buf, which has a command substitution in it
+static size_t dquote_run(Parser *p, const char *buf, size_t len)
+{
+	size_t j = 0;
+	while (j < len && buf[j] != '"')
+	{
+		ssize_t n = subst_len(buf + j, len - j);
+		if (n < 0)
+		{
+			p->error = buf[j] == '`' ? '`' : '(';
+			return j;
+		}
+		j += n > 0 ? (size_t)n : 1;
+	}
+	return j;
+}
 
-	int dest_mem_filled = 0;
-	char *dest_ptr = NULL;
+// get the command of the current stage, creating it on first use
+static Command *current_command(Parser *p)
+{
+	if (p->command != NULL)
+		return p->command;
+	Command *cmd = arena_alloc(p->arena, sizeof(Command));
+	if (p->pipeline->last_command != NULL)
+		p->pipeline->last_command->next = cmd;
+	else
+		p->pipeline->commands = cmd;
+	p->pipeline->last_command = cmd;
+	p->pipeline->ncommands++;
+	p->command = cmd;
+	return cmd;
+}
 
-	// pointers
-	char *curr_token_begin = cmdline;
-	char *prev_token_end = cmdline;
-	char *current = cmdline;
-	char *current_next = NULL;
+// append a slice to a word
+static void part_add(Parser *p, Word *word, const char *text, size_t len, int quoted)
+{
+	WordPart *part = arena_alloc(p->arena, sizeof(WordPart));
+	part->text = text;
+	part->len = len;
+	part->quoted = quoted;
+	if (word->last_part != NULL)
+		word->last_part->next = part;
+	else
+		word->parts = part;
+	word->last_part = part;
+	word->len += len;
+}
 
-	// we want to maintain a pointer to current task
-	Task *current_task = new_job->tasks;
-	// more specifically a pointer to current operating argv is desired
-	char **current_argv = new_job->tasks->argv;
-	dest_mem_filled = 0;
+// append a slice to the word being assembled, starting a new word if needed
+static void word_add(Parser *p, const char *text, size_t len, int quoted)
+{
+	if (p->word == NULL)
+		p->word = arena_alloc(p->arena, sizeof(Word));
+	// an empty quoted string only needs the word to exist
+	if (len > 0)
+		part_add(p, p->word, text, len, quoted);
+}
 
-	// pre-allocate memory for redirections
-	char *inredir = calloc(sizeof(char), 256);
-	char *outredir = calloc(sizeof(char), 256);
-	char *appredir = calloc(sizeof(char), 256);
+// a here-document got its delimiter: queue it for the lines after this one
+static void add_heredoc(Parser *p, Redir *redir, Word *delim)
+{
+	Heredoc *doc = arena_alloc(p->arena, sizeof(Heredoc));
+	doc->body = redir->body = arena_alloc(p->arena, sizeof(Word));
+	// the delimiter is matched after quote removal, and never expanded
+	doc->delim = arena_alloc(p->arena, delim->len + 1);
+	for (WordPart *part = delim->parts; part != NULL; part = part->next)
+	{
+		memcpy(doc->delim + doc->delim_len, part->text, part->len);
+		doc->delim_len += part->len;
+		if (part->quoted)
+			doc->quoted = 1;
+	}
+	doc->strip = p->pending_strip;
+	if (p->last_heredoc != NULL)
+		p->last_heredoc->next = doc;
+	else
+		p->heredocs = doc;
+	p->last_heredoc = doc;
+}
+
+/**
+ * Take one line of the body of the oldest pending here-document, which is
+ * either its delimiter or goes into the body as a slice.
+ * @return where the next line starts
+ */
+static size_t body_line(Parser *p, char *buf, size_t len, size_t i)
+{
+	Heredoc *doc = p->heredocs;
+	char *newline = memchr(buf + i, '\n', len - i);
+	size_t end = newline != NULL ? (size_t)(newline - buf) + 1 : len;
+	if (doc->strip)
+		while (i < end && buf[i] == '\t')
+			i++;
+	size_t n = end - i - (newline != NULL);
+	if (n == doc->delim_len && memcmp(buf + i, doc->delim, n) == 0)
+	{
+		p->heredocs = doc->next;
+		if (p->heredocs == NULL)
+		{
+			p->last_heredoc = NULL;
+			p->in_body = 0;
+		}
+	}
+	else if (end > i)
+		part_add(p, doc->body, buf + i, end - i, doc->quoted ? '\'' : 0);
+	return end;
+}
+
+// whether a word starts with an unquoted NAME=
+static int is_assignment(Word *word)
+{
+	WordPart *part = word->parts;
+	if (part == NULL || part->quoted)
+		return 0;
+	size_t n = var_name_len(part->text, part->len);
+	return n > 0 && n < part->len && part->text[n] == '=';
+}
 
-	// set job internals ready
-	memcpy(new_job->cmdline, cmdline, strlen(cmdline));
-	new_job->cmdline[strlen(cmdline) - 1] = 0;
-	new_job->cmdline[strlen(cmdline)] = 0;
+// a word has ended: it is either the file of a pending redirection or an argument
+static void word_end(Parser *p)
+{
+	Word *word = p->word;
+	if (word == NULL)
+		return;
+	p->word = NULL;
+	// "time" in front of a pipeline is a keyword, not a command
+	if (p->stage == 0 && p->command == NULL && !p->pending_redir && word->parts != NULL &&
+	    word->parts == word->last_part && !word->parts->quoted && word->len == 4 &&
+	    memcmp(word->parts->text, "time", 4) == 0)
+	{
+		p->pipeline->timed = 1;
+		return;
+	}
+	// NAME=value in front of the command name is an assignment
+	if (!p->pending_redir && (p->command == NULL || p->command->nwords == 0) && is_assignment(word))
+	{
+		Command *cmd = current_command(p);
+		if (cmd->last_assign != NULL)
+			cmd->last_assign->next = word;
+		else
+			cmd->assigns = word;
+		cmd->last_assign = word;
+		cmd->nassigns++;
+		p->after_pipe = 0;
+		p->after_andor = 0;
+		return;
+	}
+	Command *cmd = current_command(p);
+	if (p->pending_redir)
+	{
+		Redir *redir = arena_alloc(p->arena, sizeof(Redir));
+		redir->type = p->pending_redir;
+		redir->target = word;
+		if (cmd->last_redir != NULL)
+			cmd->last_redir->next = redir;
+		else
+			cmd->redirs = redir;
+		cmd->last_redir = redir;
+		if (redir->type == REDIR_OUT || redir->type == REDIR_APPEND)
+			p->has_outredir = 1;
+		else
+			p->has_inredir = 1;
+		if (redir->type == REDIR_HEREDOC)
+			add_heredoc(p, redir, word);
+		p->pending_redir = 0;
+		return;
+	}
+	if (cmd->last_word != NULL)
+		cmd->last_word->next = word;
+	else
+		cmd->words = word;
+	cmd->last_word = word;
+	cmd->nwords++;
+	p->after_pipe = 0;
+	p->after_andor = 0;
+}
+
+/**
+ * End the current pipeline with one of ; & && || and start the next one.
+ * @param p the parser
+ * @param op the operator, '&&' as 'A' and '||' as 'O'
+ * @param at where the operator starts in the line
+ */
+static void end_pipeline(Parser *p, int op, size_t at)
+{
+	if (p->pending_redir || p->after_pipe || p->command == NULL)
+	{
+		p->error = op;
+		return;
+	}
+	p->pipeline->end = at;
+	if (op == '&')
+	{
+		p->pipeline->background = 1;
+		p->pipeline->end++;
+	}
+	Pipeline *next = arena_alloc(p->arena, sizeof(Pipeline));
+	next->connector = op == 'A' ? LIST_AND : op == 'O' ? LIST_OR : LIST_SEQ;
+	next->start = at + (op == 'A' || op == 'O' ? 2 : 1);
+	p->pipeline->next = next;
+	p->prev_pipeline = p->pipeline;
+	p->pipeline = next;
+	p->command = NULL;
+	p->stage = 0;
+	p->has_inredir = 0;
+	p->has_outredir = 0;
+	p->after_andor = op == 'A' || op == 'O';
+}
 
-	// begin parsing
-	// !! WARNING: SHIT PILE BELOW !!
-	while (*current != -1)
+// handle one of the operators | < > >> and the here-documents << <<- <<<
+static void operator(Parser *p, int op)
+{
+	switch (op)
 	{
-		switch (*current)
+	case '<':
+	case 'h': // <<
+	case 't': // <<-
+	case 'w': // <<<
+		// only the first stage may read from a file, and only once
+		if (p->stage > 0 || p->has_inredir)
+			p->error = 'i';
+		else if (p->pending_redir)
+			p->error = '<';
+		else
 		{
-		case 39: // single quote
-			// UGLY: FOR CPPLINT CHECK
-			single_quote_handler(&in_single_quote, &in_double_quote, &current, &curr_token_begin,
-					     &in_token, &dest_mem_filled, &current_argv, &dest_ptr);
-			break;
+			p->pending_redir = op == '<' ? REDIR_IN : op == 'w' ? REDIR_HERESTRING : REDIR_HEREDOC;
+			p->pending_strip = op == 't';
+		}
+		break;
+	case '>':
+	case 'a': // >>
+		if (p->has_outredir)
+			p->error = 'o';
+		else if (p->pending_redir || p->after_pipe)
+			p->error = '>';
+		else
+			p->pending_redir = op == '>' ? REDIR_OUT : REDIR_APPEND;
+		break;
+	case '|':
+		if (p->pending_redir || p->command == NULL)
+			p->error = p->after_pipe ? 'm' : '|';
+		else if (p->has_outredir)
+			// output of this stage would go to the file, not the pipe
+			p->error = 'o';
+		else
+		{
+			p->command = NULL;
+			p->stage++;
+			p->has_inredir = 0;
+			p->has_outredir = 0;
+			p->after_pipe = 1;
+		}
+		break;
+	}
+}
 
-		case 34: // double quote
-			// UGLY: FOR CPPLINT CHECK
-			double_quote_handler(&in_single_quote, &in_double_quote, &current, &curr_token_begin,
-					     &in_token, &dest_mem_filled, &current_argv, &dest_ptr);
-			break;
+// handle the operator the last chunk ended in, now that this one tells
+// whether it is doubled; returns how much of this chunk it took
+static size_t held_operator(Parser *p, const char *buf, size_t len)
+{
+	int op = p->held;
+	int doubled = len > 0 && buf[0] == op;
+	p->held = 0;
+	if (op == '>')
+		operator(p, doubled ? 'a' : '>');
+	else if (op == '|' && !doubled)
+		operator(p, '|');
+	else
+		end_pipeline(p, !doubled ? '&' : op == '&' ? 'A' : 'O', p->offset - 1);
+	return doubled;
+}
 
-		case 32: // space
-			// only do something if we are not in quote
-			if (!in_double_quote && !in_single_quote)
+/**
+ * Run the lexer over a buffer. Unquoted newlines are turned into spaces
+ * in place, everything else is left untouched and referenced by slices.
+ */
+static void lex(Parser *p, char *buf, size_t len)
+{
+	size_t i = 0;
+	if (p->held)
+		i = held_operator(p, buf, len);
+	while (i < len && !p->error)
+	{
+		if (p->in_body)
+		{
+			i = body_line(p, buf, len, i);
+			continue;
+		}
+		if (p->quote)
+		{
+			// the whole quoted run is one slice
+			char *end = memchr(buf + i, p->quote, len - i);
+			size_t n = end ? (size_t)(end - (buf + i)) : len - i;
+			// a command substitution in double quotes may hold quotes of its own
+			if (p->quote == '"' && (memchr(buf + i, '$', n) != NULL || memchr(buf + i, '`', n) != NULL))
 			{
-				// end of token
-				*current = 0;
-				// check in redirection...
-				if (in_appredir)
-				{
-					in_appredir = 0;
-					if (!out_redirected)
-					{
-						if (dest_mem_filled)
-							strcat(appredir,
-							       curr_token_begin);
-						else
-						{
-							strcpy(appredir,
-							       curr_token_begin);
-							dest_mem_filled = 1;
-						}
-						out_redirected = 1;
-						prev_token_end = current - 1;
-					}
-					else
-					{
-						error_parsing =
-						    'o'; // duplicate output redirection
-						goto accidental_end;
-					}
-				}
-				else if (in_inredir)
-				{
-					in_inredir = 0;
-					if (!in_redirected)
-					{
-						if (dest_mem_filled)
-							strcat(inredir,
-							       curr_token_begin);
-						else
-						{
-							strcpy(inredir,
-							       curr_token_begin);
-							dest_mem_filled = 1;
-						}
-						in_redirected = 1;
-						prev_token_end = current - 1;
-					}
-					else
-					{
-						error_parsing = 'i'; // duplicate input redirectino
-						goto accidental_end;
-					}
-				}
-				else if (in_outredir)
-				{
-					in_outredir = 0;
-					if (!out_redirected)
-					{
-						if (dest_mem_filled)
-							strcat(outredir,
-							       curr_token_begin);
-						else
-						{
-							strcpy(outredir,
-							       curr_token_begin);
-							dest_mem_filled = 1;
-						}
-						out_redirected = 1;
-						prev_token_end = current - 1;
-					}
-					else
-					{
-						error_parsing = 'o';
-						goto accidental_end;
-					}
-				}
-				// also check for pipe
-				else if (wait_for_pipe)
-				{
-					current_next = current + 1;
-					if (*current_next != 32)
-						wait_for_pipe = 0;
-					curr_token_begin = current + 1;
-				}
-				// finally, save to token
-				// note: only need to do so if we are in token; skip if not
-				else if (in_token)
-				{
-					if (dest_mem_filled)
-						strcat(*current_argv,
-						       curr_token_begin);
-					else
-					{
-						*current_argv = calloc(sizeof(char), 256);
-						strcpy(*current_argv,
-						       curr_token_begin);
-						dest_mem_filled = 1;
-					}
-					// now is time to move argv pointer
-					current_argv++;
-					// set previous token end position
-					prev_token_end = current - 1;
-				}
-				// disable flags (if needed; if no token encountered, shouldn't disable)
-				in_token = 0;
-				dest_mem_filled = 0;
-				if (current_argv > current_task->argv) // token should have been saved above
-					wait_for_pipe = 0;
-				// don't touch redir carelessly
-				if (*inredir)
-					in_inredir = 0;
-				if (*outredir)
-					in_outredir = 0;
-				if (*appredir)
-					in_appredir = 0;
-				curr_token_begin = current + 1;
+				n = dquote_run(p, buf + i, len - i);
+				end = i + n < len ? buf + i + n : NULL;
 			}
-			// if in quote do nothing
-			break;
-
-		case 124: // pipe
-			// if in quote, do nothing
-			if (in_double_quote || in_single_quote)
-			{
-				if (!in_appredir && !in_outredir && !in_inredir)
-					in_token = 1;
+			word_add(p, buf + i, n, p->quote);
+			i += n;
+			if (end == NULL || p->error)
 				break;
-			}
-			// okay, we are not in quote
-			// check for grammar error
-			if (current == cmdline)
-			{
-				// pipe is the first token
-				error_parsing = '|';
-				goto accidental_end;
-			}
-			// and more grammar checks...
-			switch (*prev_token_end)
-			{
-			case 60: // input redirection
-				error_parsing = '|';
-				goto accidental_end;
-			case 62: // output redirection
-				error_parsing = '|';
-				goto accidental_end;
-			case 124: // pipe
-				error_parsing =
-				    'm'; // m stands for missing program
-				goto accidental_end;
-			}
-			// now we are safe for grammar errors
-			// check if in token. if it is copy it to argv
-			if (in_token && !(in_double_quote || in_single_quote))
-			{
-				*current = '\0';
-				if (dest_mem_filled)
-					strcat(*current_argv, curr_token_begin);
-				else
-				{
-					*current_argv = calloc(sizeof(char), 256);
-					strcpy(*current_argv, curr_token_begin);
-					dest_mem_filled = 1;
-				}
-				current_argv++;
-				curr_token_begin = current + 1;
-				// restore pipe
-				*current = '|';
-			}
-			// check if input redirection (only for first task)
-			else if (in_inredir && current_task->taskid == 0)
-			{
-				if (!in_redirected)
-				{
-					if (dest_mem_filled)
-						strcat(*current_argv,
-						       curr_token_begin);
-					else
-					{
-						*current_argv = calloc(sizeof(char), 256);
-						strcpy(*current_argv,
-						       curr_token_begin);
-						dest_mem_filled = 1;
-					}
-				}
-				else
-				{
-					error_parsing = 'i';
-					goto accidental_end;
-				}
-				curr_token_begin = current + 1;
-			}
-			// throw an error if in output redirection or duplicate input
-			else if (out_redirected || (in_inredir && current_task->taskid > 0))
+			p->quote = 0;
+			i++;
+			continue;
+		}
+		switch (buf[i])
+		{
+		case '\n':
+			buf[i] = ' ';
+			word_end(p);
+			i++;
+			// the bodies of the line's here-documents come next
+			if (p->heredocs != NULL && !p->error)
 			{
-				if (in_inredir || in_redirected)
-					error_parsing = 'i';
-				else
-					error_parsing = 'o';
-				goto accidental_end;
+				p->in_body = 1;
+				if (p->cmd_end == 0)
+					p->cmd_end = p->offset + i;
 			}
-			// now we are safe for everything
-			// fds for this task is not set, set them
-			if (*inredir)
-				// we care only about assigning fd, errors are handled by execute();
-				// if invalid fd, no execvp for this task and pipes go through
-				prepare_fd(inredir, &(current_task->srcfd), 1);
-			if (*outredir)
-				prepare_fd(outredir, &(current_task->dstfd), 2);
-			if (*appredir)
-				prepare_fd(appredir, &(current_task->dstfd), 3);
-			// terminate argv[] by NULL (reqired by execvp)
-			current_argv = NULL;
-			// request a new task and acquire argv pointer
-			current_task = add_task(new_job);
-			current_argv = current_task->argv;
-			// clear file names
-			memset(inredir, 0, 256);
-			memset(outredir, 0, 256);
-			memset(appredir, 0, 256);
-			// do the rountine
-			in_token = 0;
-			dest_mem_filled = 0;
-			in_redirected = 1; // we pipe output of "this" task to "next" task
-			in_inredir = 0;
-			in_outredir = 0;
-			in_appredir = 0;
-			wait_for_pipe = 1;
-			prev_token_end = current;
 			break;
-
-		case 60: // input redirection
-			// if in quote, do nothing
-			if (in_single_quote || in_double_quote)
-			{
-				if (!in_appredir && !in_outredir && !in_inredir)
-					in_token = 1;
+		case ' ':
+		case '\t':
+			word_end(p);
+			i++;
+			break;
+		case '\'':
+		case '"':
+			word_add(p, buf + i, 0, 0);
+			p->quote = buf[i];
+			i++;
+			break;
+		case '<':
+		{
+			word_end(p);
+			if (p->error)
 				break;
-			}
-			// okay, we are not in quote
-
-			// check if already redirected
-			if (in_redirected)
+			int op = '<';
+			size_t n = 1;
+			if (i + 1 < len && buf[i + 1] == '<')
 			{
-				error_parsing = 'i';
-				goto accidental_end;
+				op = i + 2 < len && buf[i + 2] == '<' ? 'w' : i + 2 < len && buf[i + 2] == '-' ? 't' : 'h';
+				n = op == 'h' ? 2 : 3;
 			}
-			// check for grammar error
-			else if ((*(prev_token_end) == '<' || *prev_token_end == '|' ||
-				  *prev_token_end == '>') &&
-				 prev_token_end != cmdline)
-			{
-				error_parsing = '<';
-				goto accidental_end;
-			}
-			// check whether there is token
-			if (in_token || in_appredir || in_outredir)
+			operator(p, op);
+			i += n;
+			break;
+		}
+		case ';':
+			word_end(p);
+			if (!p->error)
+				end_pipeline(p, ';', p->offset + i);
+			i++;
+			break;
+		case '>':
+		case '|':
+		case '&':
+		{
+			word_end(p);
+			if (p->error)
+				break;
+			int op = buf[i];
+			int doubled = i + 1 < len && buf[i + 1] == op;
+			if (i + 1 == len)
+				// wait for the next chunk to tell '>' from ">>", '&' from "&&"...
+				p->held = op;
+			else if (op == '>')
+				operator(p, doubled ? 'a' : '>');
+			else if (op == '&')
+				end_pipeline(p, doubled ? 'A' : '&', p->offset + i);
+			else if (doubled)
+				end_pipeline(p, 'O', p->offset + i);
+			else
+				operator(p, '|');
+			i += 1 + doubled;
+			break;
+		}
+		default:
+		{
+			// unquoted run up to the next special character; a command
+			// substitution is taken whole, whatever it holds
+			size_t j = i;
+			while (j < len && strchr(" \t\n'\"|<>&;", buf[j]) == NULL)
 			{
-				*current = '\0';
-				if (in_token)
-					dest_ptr = *current_argv;
-				else if (in_appredir)
-				{
-					dest_ptr = appredir;
-					in_appredir = 0;
-					out_redirected = 1;
-				}
-				else
-				{
-					dest_ptr = outredir;
-					in_outredir = 0;
-					out_redirected = 1;
-				}
-				if (dest_mem_filled)
-					strcat(dest_ptr, curr_token_begin);
-				else
+				ssize_t n = buf[j] == '$' || buf[j] == '`' ? subst_len(buf + j, len - j) : 0;
+				if (n < 0)
 				{
-					if (in_token)
-					{
-						*current_argv = calloc(sizeof(char), 256);
-						dest_ptr = *current_argv;
-					}
-					strcpy(dest_ptr, curr_token_begin);
-					dest_mem_filled = 1;
+					p->error = buf[j] == '`' ? '`' : '(';
+					break;
 				}
-				if (in_token)
-					current_argv++;
-				curr_token_begin = current + 1;
-				// restore current
-				*current = '<';
+				j += n > 0 ? (size_t)n : 1;
 			}
-			// okay, we are safe for a new redirection
-			// set flags and pointers
-			in_inredir = 1;
-			// note: we don't want to set "redirected" here
-			// since we have not been "redirected" yet.
-			// set "redirected" after a new token is encountered.
-			in_token = 0;
-			prev_token_end = current;
-			// directly go to next char except space (makes lives easier for current++)
-			do
-			{
-				current++;
-			} while (*current == ' ');
-			current--;
-			curr_token_begin = current + 1;
-			dest_ptr = inredir;
-			dest_mem_filled = 0;
+			word_add(p, buf + i, j - i, 0);
+			i = j;
 			break;
+		}
+		}
+	}
+}
 
-		case 62: // output redirection
-			if (in_single_quote || in_double_quote)
-			{
-				if (!in_appredir && !in_outredir && !in_inredir)
-					in_token = 1;
-				break;
-			}
+// create one Task per Command of the pipeline
+static void build_tasks(Pipeline *pipeline, Job *new_job)
+{
+	Task *task = new_job->tasks;
+	for (Command *cmd = pipeline->commands; cmd != NULL; cmd = cmd->next)
+	{
+		if (cmd != pipeline->commands)
+			task = add_task(new_job);
+		task->cmd = cmd;
+	}
+	new_job->pipeline = pipeline;
+	new_job->background = pipeline->background;
+}
 
-			if (out_redirected)
-			{
-				error_parsing = 'o';
-				goto accidental_end;
-			}
+// glue the chunks together into the cmdline shown by "jobs"
+static char *join_chunks(Parser *p)
+{
+	if (p->chunks == p->last_chunk)
+		return p->chunks->text;
+	char *cmdline = arena_alloc(p->arena, p->total_len + 1);
+	char *dest = cmdline;
+	for (Chunk *chunk = p->chunks; chunk != NULL; chunk = chunk->next)
+	{
+		memcpy(dest, chunk->text, chunk->len);
+		dest += chunk->len;
+	}
+	return cmdline;
+}
 
-			else if ((*prev_token_end == '<' || *prev_token_end == '|' ||
-				  *prev_token_end == '>') &&
-				 prev_token_end != cmdline)
-			{
-				error_parsing = '>';
-				goto accidental_end;
-			}
+// the text of one pipeline of a list, without the blanks around it
+static char *list_text(Parser *p, const char *line, Pipeline *pipeline)
+{
+	size_t start = pipeline->start;
+	size_t end = pipeline->end;
+	while (start < end && (line[start] == ' ' || line[start] == '\t'))
+		start++;
+	while (end > start && (line[end - 1] == ' ' || line[end - 1] == '\t'))
+		end--;
+	return arena_strndup(p->arena, line + start, end - start);
+}
 
-			// check token
-			if (in_token || in_inredir)
-			{
-				*current = '\0';
-				if (in_token)
-					dest_ptr = *current_argv;
-				else
-				{
-					dest_ptr = inredir;
-					in_inredir = 0;
-					in_redirected = 1;
-				}
-				if (dest_mem_filled)
-					strcat(dest_ptr, curr_token_begin);
-				else
-				{
-					if (in_token)
-					{
-						*current_argv = calloc(sizeof(char), 256);
-						dest_ptr = *current_argv;
-					}
-					strcpy(dest_ptr, curr_token_begin);
-					dest_mem_filled = 1;
-				}
-				if (in_token)
-					current_argv++;
-				curr_token_begin = current + 1;
-				*current = '>';
-			}
-			// okay, we are safe
-			// things got a bit tricky here: we need to know which mode
-			// are we opening TRUNC? or are we opening APPEND?
-			current_next = current + 1;
-			if (*current_next == 62)
-			{
-				// APPEND
-				in_appredir = 1;
-				current = current_next;
-				prev_token_end = current;
-				do
-				{
-					current++;
-				} while (*current == ' ');
-				current--;
-				dest_ptr = appredir;
-				dest_mem_filled = 0;
-				curr_token_begin = current + 1;
-			}
-			else if (*current_next != 0)
-			{
-				in_outredir = 1;
-				prev_token_end = current;
-				do
-				{
-					current++;
-				} while (*current == ' ');
-				current--;
-				dest_ptr = outredir;
-				dest_mem_filled = 0;
-				curr_token_begin = current + 1;
-			}
-			in_token = 0;
-			break;
+/**
+ * @brief Command line parser.
+ * Handles quotes, redirections and pipes well.
+ * A line may hold a list of pipelines joined by ; & && ||. The first one goes
+ * to new_job, each other one to a job of its own chained by next_listed, all
+ * in the arena of new_job; running them in order is up to the caller.
+ * The bodies of here-documents are the lines after the one that holds them,
+ * fed in like continuation lines.
+ * Each call consumes one chunk of input (normally one line). The chunk is
+ * copied into the job's arena once and the syntax tree refers to that copy.
+ * If the command is incomplete, the parser state stays in the job and the
+ * next call with the same job resumes from it, so continuation lines only
+ * cost as much as their own length.
+ * @param cmdline Next chunk of the command line
+ * @param len Length of the chunk
+ * @param new_job Pointer to a job from create_job(); the same job for every chunk
+ * @return 0 on success; 1 if waiting for single quote; 2 double; 4 pipe, && or ||;
+ * 8 input redir; 16 output; 32 append; 64 if the chunk did not end the line;
+ * 128 if here-document bodies are still to come; value to be OR'd
+ */
+int parse(const char *cmdline, size_t len, Job *new_job)
+{
+	Parser *parser = new_job->parser;
+	if (parser == NULL)
+	{
+		parser = arena_alloc(new_job->arena, sizeof(Parser));
+		parser->arena = new_job->arena;
+		parser->pipeline = arena_alloc(parser->arena, sizeof(Pipeline));
+		new_job->pipeline = parser->pipeline;
+		new_job->parser = parser;
+	}
 
-		default:
-			// we don't handle '&' here, leave it alone
-			if (*current == '&')
-				break;
-			if (!(in_inredir || in_outredir || in_appredir))
-				in_token = 1;
-			if (wait_for_pipe && *current != ' ')
-			{
-				wait_for_pipe = 0;
-				curr_token_begin = current;
-			}
-			break;
-		}
+	// keep our own copy of the chunk, the syntax tree points into it
+	Chunk *chunk = arena_alloc(parser->arena, sizeof(Chunk));
+	chunk->text = arena_strndup(parser->arena, cmdline, len);
+	chunk->len = len;
+	if (parser->last_chunk != NULL)
+		parser->last_chunk->next = chunk;
+	else
+		parser->chunks = chunk;
+	parser->last_chunk = chunk;
+	parser->offset = parser->total_len;
+	parser->total_len += len;
 
-		// whatever we do, move to next character
-		current++;
-	}
-	// !! END SHIT PILE !!
+	lex(parser, chunk->text, len);
 
-	// at end of command line... lingering issues...
-	if (!(in_single_quote || in_double_quote || in_appredir || in_inredir || in_outredir || wait_for_pipe))
+	if (parser->error)
 	{
-		// now we are at the end of command line, do we have files to open...
-		// caution, we need to handle this only if we're not in quote, pipe, redir etc.
-		if (*inredir)
-		{
-			prepare_fd(inredir, &current_task->srcfd, 1);
-			// since we are the last task
-			// and we have valid input redir
-			// we need to (re)set the flag
-			in_inredir = 0;
-		}
-		// bind stdout to end of task
-		if (*outredir)
-			prepare_fd(outredir, &current_task->dstfd, 2);
-		else if (*appredir)
-			prepare_fd(appredir, &current_task->dstfd, 3);
-		else
-			current_task->dstfd = 1;
-		// terminate argv[] by NULL (reqired by execvp)
-		current_argv = NULL;
-		// last thing, are we background?
-		while (*current == '\0' || *current == -1)
-		{
-			if (current == cmdline)
-				break;
-			current--;
-		}
-		if (*current == '&')
-			new_job->background = 1;
-		else if (*current == '|' && (!in_single_quote && !in_double_quote))
-			wait_for_pipe = 1;
+		error_parsing = parser->error;
+		new_job->status = 0;
+		new_job->background = 0;
+		return 0;
+	}
+	// the line goes on in the next chunk
+	if (len == 0 || cmdline[len - 1] != '\n')
+		return 64;
+	if (!parser->quote)
+		word_end(parser);
+	if (parser->error)
+	{
+		error_parsing = parser->error;
+		new_job->status = 0;
+		new_job->background = 0;
+		return 0;
 	}
+	int incomplete = 0;
+	if (parser->quote == '\'')
+		incomplete = 1;
+	else if (parser->quote == '"')
+		incomplete = 2;
+	else if (parser->pending_redir)
+		// here-documents and here-strings wait like any input redirection
+		incomplete = 8 << ((parser->pending_redir > REDIR_APPEND ? REDIR_IN : parser->pending_redir) - 1);
+	else if (parser->in_body)
+		incomplete = 128;
+	else if (parser->after_pipe || parser->after_andor)
+		incomplete = 4;
+	if (incomplete)
+		return incomplete;
+
+	// a list ending in ';' or '&' leaves an empty pipeline behind
+	Pipeline *last = parser->pipeline;
+	if (last->ncommands == 0 && !last->timed && parser->prev_pipeline != NULL)
+		parser->prev_pipeline->next = NULL;
+	else
+		last->end = parser->cmd_end ? parser->cmd_end : parser->total_len;
 
-	// cleanup
-	goto end;
+	char *line = join_chunks(parser);
+	new_job->cmdline = line;
+	build_tasks(new_job->pipeline, new_job);
+	Job *job = new_job;
+	for (Pipeline *pipeline = new_job->pipeline->next; pipeline != NULL; pipeline = pipeline->next)
+	{
+		job->next_listed = create_listed_job(new_job);
+		job = job->next_listed;
+		build_tasks(pipeline, job);
+	}
+	// "jobs" shows each job of a list with its own pipeline only, and no here-document
+	if (new_job->next_listed != NULL || parser->cmd_end)
+		for (job = new_job; job != NULL; job = job->next_listed)
+			job->cmdline = list_text(parser, line, job->pipeline);
+	return 0;
+}
 
-end:
-	// restore original cmdline
-	memset(cmdline, 0, 1026);
-	strcpy(cmdline, cmdline_save);
-	free(cmdline_save);
-	free(inredir);
-	free(outredir);
-	free(appredir);
-	return (in_appredir << 5) | (in_double_quote << 1) | in_single_quote | (in_inredir << 3) | (in_outredir << 4) |
-	       (wait_for_pipe << 2);
-accidental_end:
-	memset(cmdline, 0, 1026);
-	strcpy(cmdline, cmdline_save);
-	free(cmdline_save);
-	free(inredir);
-	free(outredir);
-	free(appredir);
-	new_job->status = 0;
-	new_job->background = 0;
-	return (in_appredir << 5) | (in_double_quote << 1) | in_single_quote | (in_inredir << 3) | (in_outredir << 4) |
-	       (wait_for_pipe << 2);
+/**
+ * Tell the user what was wrong with a line parse() rejected.
+ * @param error the error_parsing it left
+ */
+void print_parse_error(int error)
+{
+	switch (error)
+	{
+	case '<':
+		report("syntax error near unexpected token `<'\n");
+		break;
+	case '>':
+		report("syntax error near unexpected token `>'\n");
+		break;
+	case '|':
+		report("syntax error near unexpected token `|'\n");
+		break;
+	case 'i':
+		report("error: duplicated input redirection\n");
+		break;
+	case 'o':
+		report("error: duplicated output redirection\n");
+		break;
+	case 'm':
+		report("error: missing program\n");
+		break;
+	case '&':
+		report("syntax error near unexpected token `&'\n");
+		break;
+	case ';':
+		report("syntax error near unexpected token `;'\n");
+		break;
+	case 'A':
+		report("syntax error near unexpected token `&&'\n");
+		break;
+	case 'O':
+		report("syntax error near unexpected token `||'\n");
+		break;
+	case '(':
+		report("syntax error: unexpected end of line looking for matching `)'\n");
+		break;
+	case '`':
+		report("syntax error: unexpected end of line looking for matching ``'\n");
+		break;
+	default:
+		break;
+	}
 }
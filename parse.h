@@ -14,6 +14,9 @@
 #include <errno.h>
 #include "jobs.h"
 
-int parse(char *cmdline, Job *new_job);
+int parse(const char *cmdline, size_t len, Job *new_job);
+int prepare_fd(char *redir, int *fd, int mode);
+ssize_t subst_len(const char *s, size_t len);
+void print_parse_error(int error);
 
 #endif
@@ -0,0 +1,189 @@
+// pipebuf.c: Capacity of the pipes between the stages of a pipeline
+// A pipe holds 64 KB unless told otherwise, so a stage that produces data
+// faster than the next one consumes it blocks after every 64 KB. With
+// "set pipebuf=SIZE" every inter-stage pipe is resized with F_SETPIPE_SZ;
+// with "set pipebuf=auto" each writing command has a size of its own, which
+// doubles whenever a run of it blocked a lot. How often a stage blocked is
+// read from its voluntary context switches, which wait4() reports anyway.
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include "pipebuf.h"
+
+#define PIPEBUF_DEFAULT (64 << 10)
+#define PIPEBUF_BUCKETS 64
+// a run of a command with this many voluntary context switches doubles its pipe
+#define PIPEBUF_GROW_SWITCHES 256
+
+// bytes asked of F_SETPIPE_SZ, 0 for the kernel default
+static long pipebuf_size = 0;
+// grow the pipes of commands that keep blocking on them
+static int pipebuf_auto = 0;
+
+// what "auto" has learnt about one command
+typedef struct _pipe_entry
+{
+	char *name;
+	long size;
+	struct _pipe_entry *next;
+} PipeEntry;
+
+static PipeEntry *buckets[PIPEBUF_BUCKETS];
+
+// FNV-1a
+static size_t hash_name(const char *name)
+{
+	uint32_t h = 2166136261u;
+	while (*name)
+	{
+		h ^= (unsigned char)*name++;
+		h *= 16777619u;
+	}
+	return h;
+}
+
+// the largest pipe an unprivileged process may ask for, read once
+static long pipebuf_max(void)
+{
+	static long max = 0;
+	if (max > 0)
+		return max;
+	max = 1 << 20;
+	FILE *file = fopen("/proc/sys/fs/pipe-max-size", "re");
+	if (file != NULL)
+	{
+		if (fscanf(file, "%ld", &max) != 1 || max < PIPEBUF_DEFAULT)
+			max = 1 << 20;
+		fclose(file);
+	}
+	return max;
+}
+
+static PipeEntry *find(const char *name, int create)
+{
+	PipeEntry **link = &buckets[hash_name(name) % PIPEBUF_BUCKETS];
+	for (; *link != NULL; link = &(*link)->next)
+		if (strcmp((*link)->name, name) == 0)
+			return *link;
+	if (!create)
+		return NULL;
+	PipeEntry *entry = malloc(sizeof(PipeEntry));
+	entry->name = strdup(name);
+	entry->size = pipebuf_size > 0 ? pipebuf_size : PIPEBUF_DEFAULT;
+	entry->next = NULL;
+	*link = entry;
+	return entry;
+}
+
+static void forget_all(void)
+{
+	for (size_t i = 0; i < PIPEBUF_BUCKETS; i++)
+	{
+		PipeEntry *entry = buckets[i];
+		while (entry != NULL)
+		{
+			PipeEntry *next = entry->next;
+			free(entry->name);
+			free(entry);
+			entry = next;
+		}
+		buckets[i] = NULL;
+	}
+}
+
+/**
+ * Set the pipe capacity from "set pipebuf=VALUE".
+ * @param value a size in bytes with an optional K, M or G suffix, "auto",
+ * or "default" (also 0) for the kernel's choice
+ * @return 0 on success, -1 if value is not one of these
+ */
+int pipebuf_set(const char *value)
+{
+	long size = 0;
+	int automatic = 0;
+	if (strcmp(value, "auto") == 0)
+		automatic = 1;
+	else if (strcmp(value, "default") != 0)
+	{
+		char *end;
+		errno = 0;
+		size = strtol(value, &end, 10);
+		int shift = 0;
+		if (*end == 'k' || *end == 'K')
+			shift = 10;
+		else if (*end == 'm' || *end == 'M')
+			shift = 20;
+		else if (*end == 'g' || *end == 'G')
+			shift = 30;
+		if (shift)
+			end++;
+		if (end == value || *end != '\0' || errno || size < 0 || size > (LONG_MAX >> shift))
+			return -1;
+		size <<= shift;
+	}
+	// what "auto" learnt was measured with the old sizes
+	forget_all();
+	pipebuf_size = size;
+	pipebuf_auto = automatic;
+	return 0;
+}
+
+// print the setting the way "set" takes it
+void pipebuf_show(void)
+{
+	if (pipebuf_auto)
+		printf("pipebuf=auto\n");
+	else if (pipebuf_size == 0)
+		printf("pipebuf=default\n");
+	else
+		printf("pipebuf=%ld\n", pipebuf_size);
+}
+
+/**
+ * Size the pipe a stage writes into. Failing is harmless: the pipe keeps
+ * the size it has, e.g. when the user is over fs.pipe-user-pages-soft.
+ * @param fd either end of the pipe
+ * @param writer argv[0] of the stage writing into it
+ */
+void pipebuf_apply(int fd, const char *writer)
+{
+	long size = pipebuf_size;
+	if (pipebuf_auto && writer != NULL)
+	{
+		PipeEntry *entry = find(writer, 0);
+		if (entry != NULL)
+			size = entry->size;
+	}
+	if (size <= 0 || size == PIPEBUF_DEFAULT)
+		return;
+	if (size > pipebuf_max())
+		size = pipebuf_max();
+	fcntl(fd, F_SETPIPE_SZ, (int)size);
+}
+
+/**
+ * Learn from a finished foreground job: every stage but the last one writes
+ * into a pipe, and a stage that blocked a lot gets twice the pipe next time.
+ * @param job the job, after every stage has been waited for
+ */
+void pipebuf_learn(Job *job)
+{
+	if (!pipebuf_auto)
+		return;
+	for (Task *task = job->tasks; task != NULL && task->next != NULL; task = task->next)
+	{
+		if (task->pid <= 0 || task->argv[0] == NULL || task->rusage.ru_nvcsw < PIPEBUF_GROW_SWITCHES)
+			continue;
+		PipeEntry *entry = find(task->argv[0], 1);
+		if (entry->size < pipebuf_max())
+			entry->size = entry->size * 2 < pipebuf_max() ? entry->size * 2 : pipebuf_max();
+	}
+}
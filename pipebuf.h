@@ -0,0 +1,13 @@
+// pipebuf.h: Capacity of the pipes between the stages of a pipeline
+
+#ifndef PIPEBUF_H
+#define PIPEBUF_H
+
+#include "jobs.h"
+
+int pipebuf_set(const char *value);
+void pipebuf_show(void);
+void pipebuf_apply(int fd, const char *writer);
+void pipebuf_learn(Job *job);
+
+#endif
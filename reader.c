@@ -0,0 +1,209 @@
+// reader.c: Line reader for the REPL, scripts and -c strings
+
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200112L
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "reader.h"
+
+#define READER_CHUNK 65536
+
+/**
+ * Create a reader on an open file descriptor.
+ * Regular files are mapped, pipes and terminals are read in large chunks.
+ * @param fd the descriptor, owned by the reader from now on
+ * @return the reader
+ */
+Reader *reader_open(int fd)
+{
+	Reader *reader = calloc(1, sizeof(Reader));
+	reader->fd = fd;
+	struct stat st;
+	if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0)
+	{
+		// map from the current offset on, so "mumsh < file" after a seek works too
+		off_t offset = lseek(fd, 0, SEEK_CUR);
+		if (offset >= 0 && offset < st.st_size)
+		{
+			long page = sysconf(_SC_PAGESIZE);
+			off_t base = offset - offset % page;
+			char *map = mmap(NULL, st.st_size - base, PROT_READ, MAP_PRIVATE, fd, base);
+			if (map != MAP_FAILED)
+			{
+				reader->map = map;
+				reader->map_len = st.st_size - base;
+				reader->base = base;
+				reader->start = offset - base;
+				reader->end = reader->map_len;
+				reader->eof = 1;
+				return reader;
+			}
+		}
+	}
+	reader->cap = READER_CHUNK;
+	reader->buf = malloc(reader->cap);
+	return reader;
+}
+
+/**
+ * Create a reader over a string, as for "mumsh -c".
+ * The string must outlive the reader.
+ */
+Reader *reader_from_string(const char *str)
+{
+	Reader *reader = calloc(1, sizeof(Reader));
+	reader->fd = -1;
+	reader->map = (char *)str;
+	reader->end = strlen(str);
+	reader->eof = 1;
+	return reader;
+}
+
+// copy an unterminated last line aside so that it can get its newline
+static ssize_t last_line(Reader *reader, const char *data, char **line)
+{
+	size_t len = reader->end - reader->start;
+	if (len + 1 > reader->cap)
+	{
+		reader->cap = len + 1;
+		reader->buf = realloc(reader->buf, reader->cap);
+	}
+	memmove(reader->buf, data + reader->start, len);
+	reader->buf[len] = '\n';
+	reader->start = reader->end;
+	*line = reader->buf;
+	return len + 1;
+}
+
+/**
+ * Get the next line. Every line handed out ends with a newline, even the
+ * last one of a file that lacks it.
+ * @param reader the reader
+ * @param line set to the line, valid until the next call
+ * @return length of the line including the newline, 0 on end of input, -1 on error
+ */
+ssize_t reader_getline(Reader *reader, char **line)
+{
+	if (reader->map != NULL)
+	{
+		if (reader->start >= reader->end)
+			return 0;
+		char *begin = reader->map + reader->start;
+		char *nl = memchr(begin, '\n', reader->end - reader->start);
+		if (nl == NULL)
+			return last_line(reader, reader->map, line);
+		*line = begin;
+		reader->start = nl + 1 - reader->map;
+		return nl + 1 - begin;
+	}
+
+	size_t scanned = 0; // bytes after start known to hold no newline
+	while (1)
+	{
+		char *begin = reader->buf + reader->start;
+		char *nl = memchr(begin + scanned, '\n', reader->end - reader->start - scanned);
+		if (nl != NULL)
+		{
+			*line = begin;
+			ssize_t len = nl + 1 - begin;
+			reader->start += len;
+			return len;
+		}
+		if (reader->eof)
+		{
+			if (reader->start == reader->end)
+				return 0;
+			return last_line(reader, reader->buf, line);
+		}
+		scanned = reader->end - reader->start;
+		if (reader_fill(reader) < 0)
+			return -1;
+	}
+}
+
+/**
+ * Tell whether reader_getline() can return without reading from the fd.
+ * @param reader the reader
+ * @return 1 if a whole line (or the end of input) is buffered
+ */
+int reader_ready(Reader *reader)
+{
+	if (reader->map != NULL || reader->eof)
+		return 1;
+	return memchr(reader->buf + reader->start, '\n', reader->end - reader->start) != NULL;
+}
+
+/**
+ * Read once from the fd into the buffer. Blocks unless the fd is readable.
+ * @param reader a buffered reader
+ * @return bytes read, 0 on end of input, -1 on error
+ */
+ssize_t reader_fill(Reader *reader)
+{
+	if (reader->map != NULL || reader->eof)
+		return 0;
+	// make room: drop what was handed out, grow if a single line fills the buffer
+	if (reader->start > 0)
+	{
+		memmove(reader->buf, reader->buf + reader->start, reader->end - reader->start);
+		reader->end -= reader->start;
+		reader->start = 0;
+	}
+	if (reader->cap - reader->end < READER_CHUNK / 2)
+	{
+		reader->cap *= 2;
+		reader->buf = realloc(reader->buf, reader->cap);
+	}
+	ssize_t n;
+	do
+		n = read(reader->fd, reader->buf + reader->end, reader->cap - reader->end);
+	while (n < 0 && errno == EINTR);
+	if (n == 0)
+		reader->eof = 1;
+	if (n > 0)
+		reader->end += n;
+	return n;
+}
+
+/**
+ * Move the file offset of a mapped stdin to the first unread line, so that
+ * commands reading their standard input see what follows in the script.
+ */
+void reader_sync(Reader *reader)
+{
+	if (reader->fd == STDIN_FILENO && reader->map != NULL)
+		lseek(reader->fd, reader->base + (off_t)reader->start, SEEK_SET);
+}
+
+/**
+ * Skip whatever the commands run since reader_sync() consumed from a mapped stdin.
+ */
+void reader_resync(Reader *reader)
+{
+	if (reader->fd == STDIN_FILENO && reader->map != NULL)
+	{
+		off_t offset = lseek(reader->fd, 0, SEEK_CUR);
+		if (offset > reader->base + (off_t)reader->start)
+			reader->start = offset - reader->base;
+		if (reader->start > reader->end)
+			reader->start = reader->end;
+	}
+}
+
+void reader_close(Reader *reader)
+{
+	if (reader == NULL)
+		return;
+	if (reader->map != NULL && reader->fd >= 0)
+		munmap(reader->map, reader->map_len);
+	if (reader->fd > STDIN_FILENO)
+		close(reader->fd);
+	free(reader->buf);
+	free(reader);
+}
@@ -0,0 +1,33 @@
+// reader.h: Line reader for the REPL, scripts and -c strings
+
+#ifndef READER_H
+#define READER_H
+
+#include <sys/types.h>
+
+// Regular files are mmap'd and read in place; everything else goes
+// through a growable buffer filled with large read()s. Lines have no
+// length limit.
+typedef struct _reader
+{
+	int fd;
+	char *map; // mmap'd file or -c string, NULL if buffered
+	size_t map_len;
+	off_t base; // file offset of map[0]
+	char *buf;
+	size_t cap;
+	size_t start; // first byte not handed out yet
+	size_t end;   // end of valid data
+	int eof;
+} Reader;
+
+Reader *reader_open(int fd);
+Reader *reader_from_string(const char *str);
+ssize_t reader_getline(Reader *reader, char **line);
+int reader_ready(Reader *reader);
+ssize_t reader_fill(Reader *reader);
+void reader_sync(Reader *reader);
+void reader_resync(Reader *reader);
+void reader_close(Reader *reader);
+
+#endif
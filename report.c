@@ -0,0 +1,26 @@
+// report.c: Where the shell's own error messages go
+// They go to stdout like everything else the shell prints, except while a
+// command substitution captures stdout: an error is not the output of the
+// commands, so it goes to the stdout the substitution replaced instead.
+
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#endif
+#include <stdio.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include "report.h"
+
+int report_fd = STDOUT_FILENO;
+
+/**
+ * Print an error message of the shell or of one of its builtins.
+ * @param format as for printf()
+ */
+void report(const char *format, ...)
+{
+	va_list args;
+	va_start(args, format);
+	vdprintf(report_fd, format, args);
+	va_end(args);
+}
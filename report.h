@@ -0,0 +1,10 @@
+// report.h: Where the shell's own error messages go
+
+#ifndef REPORT_H
+#define REPORT_H
+
+extern int report_fd;
+
+void report(const char *format, ...);
+
+#endif
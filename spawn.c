@@ -0,0 +1,192 @@
+// spawn.c: Start external commands with fork(), vfork() or posix_spawn()
+// fork() has to copy the page tables of the whole shell, which gets slow as
+// the shell grows; vfork() and posix_spawn() borrow the parent's memory
+// until the child has exec'd.
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include "spawn.h"
+#include "report.h"
+
+int spawn_backend = SPAWN_POSIX;
+
+static const char *backend_names[] = {"fork", "vfork", "posix_spawn"};
+
+/**
+ * Look up a backend by the name used in $MUMSH_SPAWN.
+ * @return the backend, or -1 if there is none by that name
+ */
+int spawn_backend_by_name(const char *name)
+{
+	for (int i = 0; i < 3; i++)
+		if (strcmp(name, backend_names[i]) == 0)
+			return i;
+	return -1;
+}
+
+const char *spawn_backend_name(int backend)
+{
+	return backend_names[backend];
+}
+
+/**
+ * Restore what the shell changed about signals, in a freshly forked child.
+ * Only touches kernel state, so it is safe after vfork() too.
+ */
+void child_reset_signals(void)
+{
+	signal(SIGINT, SIG_DFL);
+	signal(SIGTTOU, SIG_DFL);
+	signal(SIGCHLD, SIG_DFL);
+	sigset_t mask;
+	sigemptyset(&mask);
+	sigprocmask(SIG_SETMASK, &mask, NULL);
+}
+
+// child side of fork() and vfork(): wire up fds and process group, then exec
+static void exec_child(const char *path, char **argv, char **envp, int srcfd, int dstfd, pid_t pgid)
+{
+	child_reset_signals();
+	if (pgid >= 0)
+		setpgid(0, pgid);
+	dup2(dstfd, STDOUT_FILENO);
+	dup2(srcfd, STDIN_FILENO);
+	if (path != NULL)
+		execve(path, argv, envp);
+	else
+		execvpe(argv[0], argv, envp);
+}
+
+static pid_t spawn_fork(const char *path, char **argv, char **envp, int srcfd, int dstfd, pid_t pgid, int *error)
+{
+	pid_t pid = fork();
+	if (pid == 0)
+	{
+		exec_child(path, argv, envp, srcfd, dstfd, pgid);
+		// report() does not buffer, so the message goes out before exit
+		if (errno == ENOENT)
+		{
+			report("%s: command not found\n", argv[0]);
+			exit(127);
+		}
+		report("%s: %s\n", argv[0], strerror(errno));
+		exit(126);
+	}
+	if (pid < 0)
+		*error = errno;
+	return pid;
+}
+
+static pid_t spawn_vfork(const char *path, char **argv, char **envp, int srcfd, int dstfd, pid_t pgid, int *error)
+{
+	// the child runs in our memory until it execs, so it can hand errno back directly
+	volatile int exec_errno = 0;
+	pid_t pid = vfork();
+	if (pid == 0)
+	{
+		exec_child(path, argv, envp, srcfd, dstfd, pgid);
+		exec_errno = errno;
+		_exit(127);
+	}
+	if (pid < 0)
+	{
+		*error = errno;
+		return -1;
+	}
+	if (exec_errno)
+	{
+		// the child is gone already; reap it so it doesn't look like a job
+		waitpid(pid, NULL, 0);
+		*error = exec_errno;
+		return -1;
+	}
+	return pid;
+}
+
+static pid_t spawn_posix(const char *path, char **argv, char **envp, int srcfd, int dstfd, pid_t pgid, int *error)
+{
+	posix_spawn_file_actions_t actions;
+	posix_spawnattr_t attr;
+	posix_spawn_file_actions_init(&actions);
+	posix_spawnattr_init(&attr);
+
+	if (dstfd != STDOUT_FILENO)
+		posix_spawn_file_actions_adddup2(&actions, dstfd, STDOUT_FILENO);
+	if (srcfd != STDIN_FILENO)
+		posix_spawn_file_actions_adddup2(&actions, srcfd, STDIN_FILENO);
+
+	short flags = POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK;
+	sigset_t sigs;
+	sigemptyset(&sigs);
+	posix_spawnattr_setsigmask(&attr, &sigs);
+	sigaddset(&sigs, SIGINT);
+	sigaddset(&sigs, SIGTTOU);
+	sigaddset(&sigs, SIGCHLD);
+	posix_spawnattr_setsigdefault(&attr, &sigs);
+	if (pgid >= 0)
+	{
+		flags |= POSIX_SPAWN_SETPGROUP;
+		posix_spawnattr_setpgroup(&attr, pgid);
+	}
+	posix_spawnattr_setflags(&attr, flags);
+
+	pid_t pid;
+	int err;
+	if (path != NULL)
+		err = posix_spawn(&pid, path, &actions, &attr, argv, envp);
+	else
+		err = posix_spawnp(&pid, argv[0], &actions, &attr, argv, envp);
+	posix_spawn_file_actions_destroy(&actions);
+	posix_spawnattr_destroy(&attr);
+	if (err != 0)
+	{
+		// glibc has already reaped a child whose exec failed
+		*error = err;
+		return -1;
+	}
+	return pid;
+}
+
+/**
+ * Start an external command.
+ * @param backend SPAWN_FORK, SPAWN_VFORK or SPAWN_POSIX
+ * @param path file to exec, or NULL to look argv[0] up in $PATH
+ * @param argv NULL-terminated argv
+ * @param envp NULL-terminated environment of the command
+ * @param srcfd fd to become stdin of the child
+ * @param dstfd fd to become stdout of the child
+ * @param pgid -1 to stay in our process group, 0 to lead a new one, else the group to join
+ * @param error set to errno when -1 is returned
+ * @return pid of the child, or -1 if it could not be started. With the fork
+ * backend, exec failures are reported by the child itself instead.
+ */
+pid_t spawn_command(int backend, const char *path, char **argv, char **envp, int srcfd, int dstfd, pid_t pgid, int *error)
+{
+	pid_t pid;
+	switch (backend)
+	{
+	case SPAWN_VFORK:
+		pid = spawn_vfork(path, argv, envp, srcfd, dstfd, pgid, error);
+		break;
+	case SPAWN_POSIX:
+		pid = spawn_posix(path, argv, envp, srcfd, dstfd, pgid, error);
+		break;
+	default:
+		pid = spawn_fork(path, argv, envp, srcfd, dstfd, pgid, error);
+		break;
+	}
+	// set the group from our side as well, so it exists before we hand it the terminal;
+	// the other backends have already done so by the time they return
+	if (backend == SPAWN_FORK && pid > 0 && pgid >= 0)
+		setpgid(pid, pgid == 0 ? pid : pgid);
+	return pid;
+}
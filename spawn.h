@@ -0,0 +1,20 @@
+// spawn.h: Start external commands with fork(), vfork() or posix_spawn()
+
+#ifndef SPAWN_H
+#define SPAWN_H
+
+#include <sys/types.h>
+
+#define SPAWN_FORK 0
+#define SPAWN_VFORK 1
+#define SPAWN_POSIX 2
+
+// backend used for external commands, chosen by $MUMSH_SPAWN at startup
+extern int spawn_backend;
+
+int spawn_backend_by_name(const char *name);
+const char *spawn_backend_name(int backend);
+void child_reset_signals(void);
+pid_t spawn_command(int backend, const char *path, char **argv, char **envp, int srcfd, int dstfd, pid_t pgid, int *error);
+
+#endif
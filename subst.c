@@ -0,0 +1,197 @@
+// subst.c: Command substitution, $(...) and `...`
+// The commands are parsed into a list of jobs and run by execute_list() like
+// a line of their own, with fd 1 pointing at a capture file. Builtins at the
+// end of a pipeline therefore run in the shell and write straight into it.
+// Only a list that may run cd, exit and the like gets a forked copy of the
+// shell to run in, so that what they change stays in there, as in the
+// subshell other shells always use. Error messages of the shell and its
+// builtins skip the capture, see report.c. The capture is a memfd rather
+// than a pipe: the shell reads it once the commands are done, and a pipe
+// would fill up and block them, or block the shell writing to itself.
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "subst.h"
+#include "parse.h"
+#include "execute.h"
+#include "builtin.h"
+#include "report.h"
+
+#define SUBST_CHUNK (64 * 1024)
+
+extern int error_parsing;
+extern int interactive;
+
+// set when ^C stopped the commands of a substitution; expand_task() gives up on the job
+int subst_interrupted = 0;
+// substitutions run so far; tells run_job() whether $? comes from one
+int subst_runs = 0;
+
+// whether a command of the list assigns variables, or is, or may expand to,
+// a builtin that changes the shell
+static int needs_subshell(Job *job)
+{
+	for (; job != NULL; job = job->next_listed)
+		for (Command *cmd = job->pipeline->commands; cmd != NULL; cmd = cmd->next)
+		{
+			// x=5 alone sets x in the shell running it
+			if (cmd->nassigns > 0)
+				return 1;
+			Word *word = cmd->words;
+			char name[16];
+			if (word == NULL || word->len >= sizeof(name))
+				continue;
+			size_t len = 0;
+			for (WordPart *part = word->parts; part != NULL; part = part->next)
+			{
+				// only a plain word is known before it runs
+				if (part->quoted != '\'' && (memchr(part->text, '$', part->len) != NULL ||
+							     memchr(part->text, '`', part->len) != NULL))
+					return 1;
+				memcpy(name + len, part->text, part->len);
+				len += part->len;
+			}
+			name[len] = '\0';
+			if (builtin_changes_shell(name))
+				return 1;
+		}
+	return 0;
+}
+
+static void free_list(Job *job)
+{
+	while (job != NULL)
+	{
+		Job *next_job = job->next_listed;
+		free_job(job);
+		job = next_job;
+	}
+}
+
+// run the list in a forked copy of the shell, without job control
+static void run_subshell(Job *job, JobTable *jobs)
+{
+	pid_t pid = fork();
+	if (pid == 0)
+	{
+		interactive = 0;
+		execute_list(job, jobs);
+		_exit(last_status);
+	}
+	free_list(job);
+	if (pid < 0)
+	{
+		report("command substitution: %s\n", strerror(errno));
+		last_status = 1;
+		return;
+	}
+	int status;
+	while (waitpid(pid, &status, 0) < 0 && errno == EINTR)
+		;
+	last_status = WIFSIGNALED(status) ? 128 + WTERMSIG(status) : WEXITSTATUS(status);
+}
+
+// read all of fd from the start, growing the buffer as it fills
+static char *read_capture(int fd, size_t *len)
+{
+	size_t cap = SUBST_CHUNK;
+	size_t used = 0;
+	char *buf = malloc(cap);
+	if (buf == NULL)
+		return NULL;
+	lseek(fd, 0, SEEK_SET);
+	for (;;)
+	{
+		if (cap - used < SUBST_CHUNK)
+		{
+			char *bigger = realloc(buf, cap * 2);
+			if (bigger == NULL)
+				break;
+			buf = bigger;
+			cap *= 2;
+		}
+		ssize_t n = read(fd, buf + used, cap - used);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
+		used += n;
+	}
+	*len = used;
+	return buf;
+}
+
+/**
+ * Run the commands of a command substitution and collect what they write.
+ * Trailing newlines are removed; $? is left as the commands set it.
+ * @param text the commands, without "$(" and ")" or the backquotes
+ * @param len length of text
+ * @param jobs the job table
+ * @param out_len where the length of the output is stored
+ * @return the output, to be freed by the caller; NULL if nothing could run
+ */
+char *command_subst(const char *text, size_t len, JobTable *jobs, size_t *out_len)
+{
+	Job *job = create_job();
+	// parse() wants the line ended
+	char *line = arena_alloc(job->arena, len + 1);
+	memcpy(line, text, len);
+	line[len] = '\n';
+	int incomplete = parse(line, len + 1, job);
+	if (error_parsing || incomplete)
+	{
+		if (error_parsing)
+			print_parse_error(error_parsing);
+		else
+			report("syntax error: unexpected end of command substitution\n");
+		error_parsing = 0;
+		free_job(job);
+		return NULL;
+	}
+
+	int capture = memfd_create("command-substitution", MFD_CLOEXEC);
+	int saved_stdout = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 0);
+	if (capture < 0 || saved_stdout < 0)
+	{
+		report("command substitution: %s\n", strerror(errno));
+		if (capture >= 0)
+			close(capture);
+		if (saved_stdout >= 0)
+			close(saved_stdout);
+		free_list(job);
+		return NULL;
+	}
+	dup2(capture, STDOUT_FILENO);
+	// errors are no output of the commands; they go where stdout went before,
+	// unless an outer substitution sent them elsewhere already
+	int saved_report = report_fd;
+	if (report_fd == STDOUT_FILENO)
+		report_fd = saved_stdout;
+	subst_runs++;
+	if (needs_subshell(job))
+		run_subshell(job, jobs);
+	else
+		execute_list(job, jobs);
+	report_fd = saved_report;
+	dup2(saved_stdout, STDOUT_FILENO);
+	close(saved_stdout);
+	if (interactive && last_status == 128 + SIGINT)
+		subst_interrupted = 1;
+
+	char *output = read_capture(capture, out_len);
+	close(capture);
+	if (output == NULL)
+		return NULL;
+	while (*out_len > 0 && output[*out_len - 1] == '\n')
+		(*out_len)--;
+	return output;
+}
@@ -0,0 +1,13 @@
+// subst.h: Command substitution, $(...) and `...`
+
+#ifndef SUBST_H
+#define SUBST_H
+
+#include "jobs.h"
+
+extern int subst_interrupted;
+extern int subst_runs;
+
+char *command_subst(const char *text, size_t len, JobTable *jobs, size_t *out_len);
+
+#endif
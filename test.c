@@ -0,0 +1,313 @@
+// test.c: The "test" and "[" builtins
+// Up to four arguments are decided by their number, as POSIX specifies;
+// longer expressions go through a small recursive descent parser where
+// "-a" binds tighter than "-o".
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "test.h"
+#include "report.h"
+
+typedef struct _test_parser
+{
+	const char *name; // "test" or "[", for error messages
+	char **argv;
+	int argc;
+	int pos;
+	int error;
+} TestParser;
+
+static int is_unary(const char *op)
+{
+	return op[0] == '-' && op[1] != '\0' && op[2] == '\0' && strchr("bcdefgGhkLnOprsStuwxz", op[1]) != NULL;
+}
+
+static int is_binary(const char *op)
+{
+	static const char *const ops[] = {"=", "==", "!=", "<", ">", "-eq", "-ne", "-lt", "-le",
+					  "-gt", "-ge", "-nt", "-ot", "-ef", NULL};
+	for (int i = 0; ops[i] != NULL; i++)
+		if (strcmp(op, ops[i]) == 0)
+			return 1;
+	return 0;
+}
+
+static void test_error(TestParser *p, const char *arg, const char *message)
+{
+	if (p->error)
+		return;
+	if (arg != NULL)
+		report("%s: %s: %s\n", p->name, arg, message);
+	else
+		report("%s: %s\n", p->name, message);
+	p->error = 1;
+}
+
+static long long to_number(TestParser *p, const char *s)
+{
+	const char *start = s;
+	while (isspace((unsigned char)*start))
+		start++;
+	char *end;
+	errno = 0;
+	long long value = strtoll(start, &end, 10);
+	while (isspace((unsigned char)*end))
+		end++;
+	if (end == start || *end != '\0' || errno)
+		test_error(p, s, "integer expression expected");
+	return value;
+}
+
+static int unary(TestParser *p, const char *op, const char *arg)
+{
+	struct stat st;
+	switch (op[1])
+	{
+	case 'n':
+		return arg[0] != '\0';
+	case 'z':
+		return arg[0] == '\0';
+	case 't':
+		return isatty((int)to_number(p, arg));
+	case 'r':
+		return faccessat(AT_FDCWD, arg, R_OK, AT_EACCESS) == 0;
+	case 'w':
+		return faccessat(AT_FDCWD, arg, W_OK, AT_EACCESS) == 0;
+	case 'x':
+		return faccessat(AT_FDCWD, arg, X_OK, AT_EACCESS) == 0;
+	case 'h':
+	case 'L':
+		return lstat(arg, &st) == 0 && S_ISLNK(st.st_mode);
+	}
+	if (stat(arg, &st) != 0)
+		return 0;
+	switch (op[1])
+	{
+	case 'b':
+		return S_ISBLK(st.st_mode);
+	case 'c':
+		return S_ISCHR(st.st_mode);
+	case 'd':
+		return S_ISDIR(st.st_mode);
+	case 'e':
+		return 1;
+	case 'f':
+		return S_ISREG(st.st_mode);
+	case 'g':
+		return (st.st_mode & S_ISGID) != 0;
+	case 'G':
+		return st.st_gid == getegid();
+	case 'k':
+		return (st.st_mode & S_ISVTX) != 0;
+	case 'O':
+		return st.st_uid == geteuid();
+	case 'p':
+		return S_ISFIFO(st.st_mode);
+	case 's':
+		return st.st_size > 0;
+	case 'S':
+		return S_ISSOCK(st.st_mode);
+	case 'u':
+		return (st.st_mode & S_ISUID) != 0;
+	}
+	return 0;
+}
+
+// compare modification times; a missing file is older than any other
+static int newer(const char *left, const char *right)
+{
+	struct stat l, r;
+	if (stat(left, &l) != 0)
+		return 0;
+	if (stat(right, &r) != 0)
+		return 1;
+	if (l.st_mtim.tv_sec != r.st_mtim.tv_sec)
+		return l.st_mtim.tv_sec > r.st_mtim.tv_sec;
+	return l.st_mtim.tv_nsec > r.st_mtim.tv_nsec;
+}
+
+static int binary(TestParser *p, const char *left, const char *op, const char *right)
+{
+	if (strcmp(op, "=") == 0 || strcmp(op, "==") == 0)
+		return strcmp(left, right) == 0;
+	if (strcmp(op, "!=") == 0)
+		return strcmp(left, right) != 0;
+	if (strcmp(op, "<") == 0)
+		return strcmp(left, right) < 0;
+	if (strcmp(op, ">") == 0)
+		return strcmp(left, right) > 0;
+	if (strcmp(op, "-nt") == 0)
+		return newer(left, right);
+	if (strcmp(op, "-ot") == 0)
+		return newer(right, left);
+	if (strcmp(op, "-ef") == 0)
+	{
+		struct stat l, r;
+		return stat(left, &l) == 0 && stat(right, &r) == 0 && l.st_dev == r.st_dev && l.st_ino == r.st_ino;
+	}
+	if (strcmp(op, "-a") == 0)
+		return left[0] != '\0' && right[0] != '\0';
+	if (strcmp(op, "-o") == 0)
+		return left[0] != '\0' || right[0] != '\0';
+	long long l = to_number(p, left);
+	long long r = to_number(p, right);
+	if (strcmp(op, "-eq") == 0)
+		return l == r;
+	if (strcmp(op, "-ne") == 0)
+		return l != r;
+	if (strcmp(op, "-lt") == 0)
+		return l < r;
+	if (strcmp(op, "-le") == 0)
+		return l <= r;
+	if (strcmp(op, "-gt") == 0)
+		return l > r;
+	return l >= r; // -ge
+}
+
+static int expr_or(TestParser *p);
+
+static int primary(TestParser *p)
+{
+	if (p->pos >= p->argc)
+	{
+		test_error(p, NULL, "argument expected");
+		return 0;
+	}
+	char **argv = p->argv;
+	int pos = p->pos;
+	if (strcmp(argv[pos], "(") == 0)
+	{
+		p->pos++;
+		int value = expr_or(p);
+		if (p->pos >= p->argc || strcmp(argv[p->pos], ")") != 0)
+			test_error(p, NULL, "`)' expected");
+		p->pos++;
+		return value;
+	}
+	if (pos + 2 < p->argc && is_binary(argv[pos + 1]))
+	{
+		p->pos += 3;
+		return binary(p, argv[pos], argv[pos + 1], argv[pos + 2]);
+	}
+	if (pos + 1 < p->argc && is_unary(argv[pos]))
+	{
+		p->pos += 2;
+		return unary(p, argv[pos], argv[pos + 1]);
+	}
+	p->pos++;
+	return argv[pos][0] != '\0';
+}
+
+static int expr_not(TestParser *p)
+{
+	if (p->pos < p->argc && strcmp(p->argv[p->pos], "!") == 0)
+	{
+		p->pos++;
+		return !expr_not(p);
+	}
+	return primary(p);
+}
+
+static int expr_and(TestParser *p)
+{
+	int value = expr_not(p);
+	while (p->pos < p->argc && strcmp(p->argv[p->pos], "-a") == 0)
+	{
+		p->pos++;
+		value = expr_not(p) && value;
+	}
+	return value;
+}
+
+static int expr_or(TestParser *p)
+{
+	int value = expr_and(p);
+	while (p->pos < p->argc && strcmp(p->argv[p->pos], "-o") == 0)
+	{
+		p->pos++;
+		value = expr_and(p) || value;
+	}
+	return value;
+}
+
+/**
+ * Evaluate n arguments by the POSIX rules for their number.
+ * @param p the parser, for errors and the general case
+ * @param argv the arguments
+ * @param n how many
+ * @return 1 if true, 0 if false
+ */
+static int evaluate(TestParser *p, char **argv, int n)
+{
+	switch (n)
+	{
+	case 0:
+		return 0;
+	case 1:
+		return argv[0][0] != '\0';
+	case 2:
+		if (strcmp(argv[0], "!") == 0)
+			return !evaluate(p, argv + 1, 1);
+		if (is_unary(argv[0]))
+			return unary(p, argv[0], argv[1]);
+		test_error(p, argv[0], "unary operator expected");
+		return 0;
+	case 3:
+		if (is_binary(argv[1]) || strcmp(argv[1], "-a") == 0 || strcmp(argv[1], "-o") == 0)
+			return binary(p, argv[0], argv[1], argv[2]);
+		if (strcmp(argv[0], "!") == 0)
+			return !evaluate(p, argv + 1, 2);
+		if (strcmp(argv[0], "(") == 0 && strcmp(argv[2], ")") == 0)
+			return evaluate(p, argv + 1, 1);
+		test_error(p, argv[1], "binary operator expected");
+		return 0;
+	case 4:
+		if (strcmp(argv[0], "!") == 0)
+			return !evaluate(p, argv + 1, 3);
+		if (strcmp(argv[0], "(") == 0 && strcmp(argv[3], ")") == 0)
+			return evaluate(p, argv + 1, 2);
+		break;
+	}
+	p->argv = argv;
+	p->argc = n;
+	p->pos = 0;
+	int value = expr_or(p);
+	if (p->pos < p->argc)
+		test_error(p, p->argv[p->pos], "too many arguments");
+	return value;
+}
+
+/**
+ * test and [: evaluate an expression.
+ * @param argv the arguments; if argv[0] is "[" the last one must be "]"
+ * @return 0 if true, 1 if false, 2 on error
+ */
+int do_test(char **argv)
+{
+	TestParser parser = {argv[0], NULL, 0, 0, 0};
+	int n = 0;
+	while (argv[n + 1] != NULL)
+		n++;
+	if (strcmp(argv[0], "[") == 0)
+	{
+		if (n == 0 || strcmp(argv[n], "]") != 0)
+		{
+			report("[: missing `]'\n");
+			return 2;
+		}
+		n--;
+	}
+	int value = evaluate(&parser, argv + 1, n);
+	if (parser.error)
+		return 2;
+	return !value;
+}
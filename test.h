@@ -0,0 +1,8 @@
+// test.h: The "test" and "[" builtins
+
+#ifndef TEST_H
+#define TEST_H
+
+int do_test(char **argv);
+
+#endif
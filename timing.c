@@ -0,0 +1,52 @@
+// timing.c: Report of the "time" keyword
+// Everything comes from what wait4() left in the tasks, so reporting
+// costs no process of its own.
+
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#endif
+#ifndef _DEFAULT_SOURCE
+#define _DEFAULT_SOURCE 1
+#endif
+#include <stdio.h>
+#include <time.h>
+#include <sys/time.h>
+#include "timing.h"
+
+static double seconds(struct timeval tv)
+{
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+/**
+ * Turn getrusage() taken after running a builtin in the shell into what
+ * that builtin used. maxrss stays the shell's own.
+ * @param usage getrusage(RUSAGE_SELF) after, replaced by the difference
+ * @param before getrusage(RUSAGE_SELF) before
+ */
+void rusage_since(struct rusage *usage, const struct rusage *before)
+{
+	timersub(&usage->ru_utime, &before->ru_utime, &usage->ru_utime);
+	timersub(&usage->ru_stime, &before->ru_stime, &usage->ru_stime);
+	usage->ru_nvcsw -= before->ru_nvcsw;
+	usage->ru_nivcsw -= before->ru_nivcsw;
+}
+
+/**
+ * Print wall-clock time of a finished job, and user and system time, max
+ * RSS and voluntary/involuntary context switches of each of its stages.
+ * Goes to stderr, like the report of Bash, so it stays out of pipes and files.
+ * @param job the job, with started and finished set
+ */
+void report_times(Job *job)
+{
+	double real = (job->finished.tv_sec - job->started.tv_sec) +
+		      (job->finished.tv_nsec - job->started.tv_nsec) / 1e9;
+	fprintf(stderr, "\nreal\t%.3fs\n", real);
+	fprintf(stderr, "stage\tuser\tsys\tmaxrss\tvcsw\tivcsw\tcommand\n");
+	int stage = 0;
+	for (Task *task = job->tasks; task != NULL; task = task->next)
+		fprintf(stderr, "%d\t%.3fs\t%.3fs\t%ldk\t%ld\t%ld\t%s\n", stage++, seconds(task->rusage.ru_utime),
+			seconds(task->rusage.ru_stime), task->rusage.ru_maxrss, task->rusage.ru_nvcsw,
+			task->rusage.ru_nivcsw, task->argv != NULL && task->argv[0] != NULL ? task->argv[0] : "");
+}
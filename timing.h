@@ -0,0 +1,12 @@
+// timing.h: Report of the "time" keyword
+
+#ifndef TIMING_H
+#define TIMING_H
+
+#include <sys/resource.h>
+#include "jobs.h"
+
+void rusage_since(struct rusage *usage, const struct rusage *before);
+void report_times(Job *job);
+
+#endif
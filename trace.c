@@ -0,0 +1,113 @@
+// trace.c: Spans of the shell's own work, as Chrome trace-event JSON
+// With MUMSH_TRACE=file, each phase of the main loop and of execute() is
+// written as a complete ("X") event with the shell's pid and the job id;
+// the file loads into Perfetto or chrome://tracing. Events are collected
+// in a buffer of our own rather than stdio, so a forked child that calls
+// exit() can't write them a second time.
+
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "trace.h"
+
+#define TRACE_BUFFER 65536
+
+int trace_enabled = 0;
+
+static int trace_fd = -1;
+static pid_t trace_pid = 0; // only this process writes the file
+static char buffer[TRACE_BUFFER];
+static size_t buffered = 0;
+static int nevents = 0;
+
+static void trace_flush(void)
+{
+	if (getpid() != trace_pid)
+	{
+		buffered = 0;
+		return;
+	}
+	size_t done = 0;
+	while (done < buffered)
+	{
+		ssize_t n = write(trace_fd, buffer + done, buffered - done);
+		if (n <= 0)
+			break;
+		done += n;
+	}
+	buffered = 0;
+}
+
+/**
+ * Start tracing into a file, truncating it.
+ * @param path the file
+ * @return 0 on success, -1 if it can't be opened
+ */
+int trace_open(const char *path)
+{
+	trace_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (trace_fd < 0)
+		return -1;
+	trace_pid = getpid();
+	trace_enabled = 1;
+	memcpy(buffer, "[\n", 2);
+	buffered = 2;
+	return 0;
+}
+
+/**
+ * @return microseconds on the monotonic clock
+ */
+double trace_now(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1e6 + now.tv_nsec / 1e3;
+}
+
+/**
+ * Record a span that started at start and ends now.
+ * @param name phase of the shell
+ * @param jobid job the work was for, 0 if none yet
+ * @param start from trace_now()
+ * @param child pid of the process the span started, 0 for none
+ */
+void trace_span(const char *name, int jobid, double start, pid_t child)
+{
+	double end = trace_now();
+	char event[256];
+	int len = snprintf(event, sizeof(event),
+			   "%s{\"name\":\"%s\",\"cat\":\"mumsh\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,"
+			   "\"pid\":%d,\"tid\":%d,\"args\":{\"job\":%d",
+			   nevents ? ",\n" : "", name, start, end - start, (int)trace_pid, (int)trace_pid, jobid);
+	if (child > 0)
+		len += snprintf(event + len, sizeof(event) - len, ",\"child\":%d", (int)child);
+	len += snprintf(event + len, sizeof(event) - len, "}}");
+	if (buffered + len > sizeof(buffer))
+		trace_flush();
+	memcpy(buffer + buffered, event, len);
+	buffered += len;
+	nevents++;
+}
+
+/**
+ * Finish the JSON array and close the file.
+ */
+void trace_close(void)
+{
+	if (!trace_enabled)
+		return;
+	if (buffered + 3 > sizeof(buffer))
+		trace_flush();
+	memcpy(buffer + buffered, "\n]\n", 3);
+	buffered += 3;
+	trace_flush();
+	close(trace_fd);
+	trace_enabled = 0;
+}
@@ -0,0 +1,33 @@
+// trace.h: Spans of the shell's own work, as Chrome trace-event JSON
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <sys/types.h>
+
+// set when MUMSH_TRACE names a file; every span costs one test of it at each end
+extern int trace_enabled;
+
+// start a span: declares var holding its start time
+#define TRACE_BEGIN(var) double var = trace_enabled ? trace_now() : 0
+// end the span started with var
+#define TRACE_END(var, name, jobid)                            \
+	do                                                     \
+	{                                                      \
+		if (trace_enabled)                             \
+			trace_span(name, jobid, var, 0);        \
+	} while (0)
+// same, for a span that started the process child
+#define TRACE_END_CHILD(var, name, jobid, child)               \
+	do                                                     \
+	{                                                      \
+		if (trace_enabled)                             \
+			trace_span(name, jobid, var, child);    \
+	} while (0)
+
+int trace_open(const char *path);
+double trace_now(void);
+void trace_span(const char *name, int jobid, double start, pid_t child);
+void trace_close(void);
+
+#endif
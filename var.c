@@ -0,0 +1,333 @@
+// var.c: Shell variables, the environment of commands, "export" and "unset"
+// Variables live in a chained hash table filled from environ at startup,
+// each with a flag telling whether it is exported. The envp handed to the
+// commands we start is built from the exported ones, and only rebuilt after
+// one of them changed, so a spawn costs no copying at all.
+
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <ctype.h>
+#include "var.h"
+#include "report.h"
+
+#define VAR_INITIAL_BUCKETS 64
+
+typedef struct _var
+{
+	char *name;
+	char *value; // NULL for a name that was exported before it was set
+	int exported;
+	struct _var *next;
+} Var;
+
+static Var **buckets = NULL;
+static size_t nbuckets = 0;
+static size_t nvars = 0;
+// envp of the exported variables, NULL until it is needed again
+static char **envp = NULL;
+
+// FNV-1a
+static size_t hash_name(const char *name, size_t len)
+{
+	uint32_t h = 2166136261u;
+	for (size_t i = 0; i < len; i++)
+	{
+		h ^= (unsigned char)name[i];
+		h *= 16777619u;
+	}
+	return h;
+}
+
+static Var *find(const char *name, size_t len)
+{
+	if (nbuckets == 0)
+		return NULL;
+	for (Var *var = buckets[hash_name(name, len) % nbuckets]; var != NULL; var = var->next)
+		if (strncmp(var->name, name, len) == 0 && var->name[len] == '\0')
+			return var;
+	return NULL;
+}
+
+static void grow(void)
+{
+	size_t new_nbuckets = nbuckets ? nbuckets * 2 : VAR_INITIAL_BUCKETS;
+	Var **new_buckets = calloc(new_nbuckets, sizeof(Var *));
+	for (size_t i = 0; i < nbuckets; i++)
+	{
+		Var *var = buckets[i];
+		while (var != NULL)
+		{
+			Var *next = var->next;
+			size_t slot = hash_name(var->name, strlen(var->name)) % new_nbuckets;
+			var->next = new_buckets[slot];
+			new_buckets[slot] = var;
+			var = next;
+		}
+	}
+	free(buckets);
+	buckets = new_buckets;
+	nbuckets = new_nbuckets;
+}
+
+// the exported set changed; the next spawn builds envp again
+static void env_changed(void)
+{
+	if (envp == NULL)
+		return;
+	for (char **entry = envp; *entry != NULL; entry++)
+		free(*entry);
+	free(envp);
+	envp = NULL;
+}
+
+/**
+ * Length of the variable name s starts with: a letter or '_', then letters,
+ * digits and '_'.
+ * @return the length, 0 if s does not start with a name
+ */
+size_t var_name_len(const char *s, size_t len)
+{
+	if (len == 0 || !(isalpha((unsigned char)s[0]) || s[0] == '_'))
+		return 0;
+	size_t n = 1;
+	while (n < len && (isalnum((unsigned char)s[n]) || s[n] == '_'))
+		n++;
+	return n;
+}
+
+/**
+ * Look a variable up by a name that need not be NUL-terminated.
+ * @return its value, NULL if it is not set
+ */
+const char *var_getn(const char *name, size_t len)
+{
+	Var *var = find(name, len);
+	return var != NULL ? var->value : NULL;
+}
+
+const char *var_get(const char *name)
+{
+	return var_getn(name, strlen(name));
+}
+
+/**
+ * Set a variable, creating it if needed.
+ * @param name the name
+ * @param value the value, NULL to leave it as it is
+ * @param export 1 to export it, 0 to keep its flag (a new variable is not exported)
+ */
+void var_set(const char *name, const char *value, int export)
+{
+	size_t len = strlen(name);
+	Var *var = find(name, len);
+	if (var == NULL)
+	{
+		if (nvars >= nbuckets)
+			grow();
+		var = calloc(1, sizeof(Var));
+		var->name = strdup(name);
+		size_t slot = hash_name(name, len) % nbuckets;
+		var->next = buckets[slot];
+		buckets[slot] = var;
+		nvars++;
+	}
+	if (value != NULL)
+	{
+		free(var->value);
+		var->value = strdup(value);
+	}
+	if (export)
+		var->exported = 1;
+	if (var->exported)
+		env_changed();
+}
+
+/**
+ * Set a variable from "NAME=value".
+ * @param assignment the assignment, with a valid name
+ * @param export as for var_set()
+ */
+void var_assign(const char *assignment, int export)
+{
+	const char *eq = strchr(assignment, '=');
+	char *name = strndup(assignment, eq - assignment);
+	var_set(name, eq + 1, export);
+	free(name);
+}
+
+void var_unset(const char *name)
+{
+	if (nbuckets == 0)
+		return;
+	size_t len = strlen(name);
+	Var **link = &buckets[hash_name(name, len) % nbuckets];
+	while (*link != NULL)
+	{
+		if (strcmp((*link)->name, name) == 0)
+		{
+			Var *var = *link;
+			*link = var->next;
+			if (var->exported)
+				env_changed();
+			free(var->name);
+			free(var->value);
+			free(var);
+			nvars--;
+			return;
+		}
+		link = &(*link)->next;
+	}
+}
+
+/**
+ * Take in the environment the shell was started with; all of it is exported.
+ * @param env the environment, as environ
+ */
+void var_init(char **env)
+{
+	for (; *env != NULL; env++)
+	{
+		const char *eq = strchr(*env, '=');
+		if (eq != NULL && var_name_len(*env, eq - *env) == (size_t)(eq - *env))
+			var_assign(*env, 1);
+	}
+}
+
+/**
+ * The environment of a command, built from the exported variables. It stays
+ * valid until a variable changes, and must not be freed.
+ * @return NULL-terminated "NAME=value" strings
+ */
+char **var_environ(void)
+{
+	if (envp != NULL)
+		return envp;
+	size_t n = 0;
+	envp = malloc(sizeof(char *) * (nvars + 1));
+	for (size_t i = 0; i < nbuckets; i++)
+		for (Var *var = buckets[i]; var != NULL; var = var->next)
+		{
+			if (!var->exported || var->value == NULL)
+				continue;
+			size_t name_len = strlen(var->name);
+			size_t value_len = strlen(var->value);
+			char *entry = malloc(name_len + value_len + 2);
+			memcpy(entry, var->name, name_len);
+			entry[name_len] = '=';
+			memcpy(entry + name_len + 1, var->value, value_len + 1);
+			envp[n++] = entry;
+		}
+	envp[n] = NULL;
+	return envp;
+}
+
+/**
+ * The environment of a command with assignments in front of it, which
+ * override the exported variables of the same name for it alone.
+ * @param assigns NULL-terminated "NAME=value" strings
+ * @param arena where the array is allocated; the strings are shared
+ * @return NULL-terminated "NAME=value" strings
+ */
+char **var_environ_with(char **assigns, Arena *arena)
+{
+	char **base = var_environ();
+	size_t nbase = 0;
+	size_t nassigns = 0;
+	while (base[nbase] != NULL)
+		nbase++;
+	while (assigns[nassigns] != NULL)
+		nassigns++;
+	char **env = arena_alloc(arena, sizeof(char *) * (nbase + nassigns + 1));
+	size_t n = 0;
+	for (size_t i = 0; i < nbase; i++)
+	{
+		size_t len = strchr(base[i], '=') - base[i] + 1;
+		size_t j = 0;
+		while (j < nassigns && strncmp(base[i], assigns[j], len) != 0)
+			j++;
+		if (j == nassigns)
+			env[n++] = base[i];
+	}
+	for (size_t j = 0; j < nassigns; j++)
+		env[n++] = assigns[j];
+	env[n] = NULL;
+	return env;
+}
+
+static int compare_vars(const void *a, const void *b)
+{
+	return strcmp((*(Var *const *)a)->name, (*(Var *const *)b)->name);
+}
+
+// a valid name, or with allow_value also a valid name followed by "=value"
+static int valid_operand(const char *arg, int allow_value, const char *builtin)
+{
+	size_t len = allow_value ? strcspn(arg, "=") : strlen(arg);
+	if (len > 0 && var_name_len(arg, len) == len)
+		return 1;
+	report("%s: `%s': not a valid identifier\n", builtin, arg);
+	return 0;
+}
+
+/**
+ * export: export variables, setting them first with NAME=value; with no
+ * arguments (or -p), list the exported ones in a form it takes back.
+ * @param argv "export" followed by NAME or NAME=value
+ * @return 0 on success, 1 if a name was not valid
+ */
+int do_export(char **argv)
+{
+	if (argv[1] == NULL || (strcmp(argv[1], "-p") == 0 && argv[2] == NULL))
+	{
+		Var **sorted = malloc(sizeof(Var *) * (nvars ? nvars : 1));
+		size_t n = 0;
+		for (size_t i = 0; i < nbuckets; i++)
+			for (Var *var = buckets[i]; var != NULL; var = var->next)
+				if (var->exported)
+					sorted[n++] = var;
+		qsort(sorted, n, sizeof(Var *), compare_vars);
+		for (size_t i = 0; i < n; i++)
+		{
+			if (sorted[i]->value != NULL)
+				printf("export %s=\"%s\"\n", sorted[i]->name, sorted[i]->value);
+			else
+				printf("export %s\n", sorted[i]->name);
+		}
+		free(sorted);
+		return 0;
+	}
+	int status = 0;
+	for (int i = 1; argv[i] != NULL; i++)
+	{
+		if (!valid_operand(argv[i], 1, "export"))
+			status = 1;
+		else if (strchr(argv[i], '=') != NULL)
+			var_assign(argv[i], 1);
+		else
+			var_set(argv[i], NULL, 1);
+	}
+	return status;
+}
+
+/**
+ * unset: remove variables.
+ * @param argv "unset" followed by names
+ * @return 0 on success, 1 if a name was not valid
+ */
+int do_unset(char **argv)
+{
+	int status = 0;
+	for (int i = 1; argv[i] != NULL; i++)
+	{
+		if (valid_operand(argv[i], 0, "unset"))
+			var_unset(argv[i]);
+		else
+			status = 1;
+	}
+	return status;
+}
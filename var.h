@@ -0,0 +1,21 @@
+// var.h: Shell variables, the environment of commands, "export" and "unset"
+
+#ifndef VAR_H
+#define VAR_H
+
+#include <stddef.h>
+#include "arena.h"
+
+void var_init(char **env);
+size_t var_name_len(const char *s, size_t len);
+const char *var_get(const char *name);
+const char *var_getn(const char *name, size_t len);
+void var_set(const char *name, const char *value, int export);
+void var_assign(const char *assignment, int export);
+void var_unset(const char *name);
+char **var_environ(void);
+char **var_environ_with(char **assigns, Arena *arena);
+int do_export(char **argv);
+int do_unset(char **argv);
+
+#endif
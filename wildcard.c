@@ -0,0 +1,351 @@
+// wildcard.c: Pathname expansion of *, ? and [...]
+// A pattern is matched one path component at a time, against the sorted
+// names of a directory. Listings are kept between commands, so globbing a
+// big directory over and over costs a stat() instead of readdir() and a
+// sort each time. A listing is found by the identity (device and inode) of
+// the directory the path leads to, which stays right across cd, and is used
+// again only while the directory's mtime and ctime are what they were.
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <dirent.h>
+#include <fnmatch.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include "wildcard.h"
+
+// listings kept; the one used least recently goes first
+#define GLOB_CACHE_DIRS 64
+
+typedef struct _listing
+{
+	dev_t dev;
+	ino_t ino;
+	struct timespec mtime;
+	struct timespec ctime;
+	struct timespec listed; // when readdir() started
+	char **names;		// sorted by strcmp()
+	size_t nnames;
+	char *blob; // the names, one after the other
+	unsigned long used;
+	int busy; // being walked; not to be dropped
+} Listing;
+
+static Listing **listings = NULL;
+static size_t nlistings = 0;
+static unsigned long use_clock = 0;
+
+// what the matches of one pattern are collected in
+typedef struct _glob
+{
+	Arena *arena;
+	char path[PATH_MAX];
+	char **paths;
+	size_t npaths;
+	size_t cap;
+	int sort; // matches came from more than one directory level
+} Glob;
+
+static int compare_names(const void *a, const void *b)
+{
+	return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+static int same_time(struct timespec a, struct timespec b)
+{
+	return a.tv_sec == b.tv_sec && a.tv_nsec == b.tv_nsec;
+}
+
+static void free_listing(Listing *dir)
+{
+	free(dir->names);
+	free(dir->blob);
+	free(dir);
+}
+
+/**
+ * Read a directory into a sorted list of names, "." and ".." left out.
+ * @return the listing, NULL if the directory cannot be read
+ */
+static Listing *read_listing(const char *path)
+{
+	DIR *dirp = opendir(path);
+	if (dirp == NULL)
+		return NULL;
+	Listing *dir = calloc(1, sizeof(Listing));
+	struct stat st;
+	clock_gettime(CLOCK_REALTIME, &dir->listed);
+	fstat(dirfd(dirp), &st);
+	dir->dev = st.st_dev;
+	dir->ino = st.st_ino;
+	dir->mtime = st.st_mtim;
+	dir->ctime = st.st_ctim;
+
+	// names go into one buffer first; it moves while it grows, so offsets
+	size_t size = 0, cap = 4096, nnames = 0, ncap = 256;
+	size_t *offsets = malloc(sizeof(size_t) * ncap);
+	dir->blob = malloc(cap);
+	struct dirent *entry;
+	while ((entry = readdir(dirp)) != NULL)
+	{
+		const char *name = entry->d_name;
+		if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+			continue;
+		size_t len = strlen(name) + 1;
+		while (size + len > cap)
+			dir->blob = realloc(dir->blob, cap *= 2);
+		if (nnames == ncap)
+			offsets = realloc(offsets, sizeof(size_t) * (ncap *= 2));
+		memcpy(dir->blob + size, name, len);
+		offsets[nnames++] = size;
+		size += len;
+	}
+	closedir(dirp);
+	dir->names = malloc(sizeof(char *) * (nnames ? nnames : 1));
+	for (size_t i = 0; i < nnames; i++)
+		dir->names[i] = dir->blob + offsets[i];
+	free(offsets);
+	dir->nnames = nnames;
+	qsort(dir->names, nnames, sizeof(char *), compare_names);
+	return dir;
+}
+
+// make room for one more listing, dropping the least recently used idle one if full
+static void cache_add(Listing *dir)
+{
+	if (nlistings >= GLOB_CACHE_DIRS)
+	{
+		size_t victim = nlistings;
+		for (size_t i = 0; i < nlistings; i++)
+			if (!listings[i]->busy && (victim == nlistings || listings[i]->used < listings[victim]->used))
+				victim = i;
+		if (victim < nlistings)
+		{
+			free_listing(listings[victim]);
+			listings[victim] = listings[--nlistings];
+		}
+	}
+	listings = realloc(listings, sizeof(Listing *) * (nlistings + 1));
+	listings[nlistings++] = dir;
+}
+
+/**
+ * The sorted names in a directory, from the cache while the directory has not
+ * changed. A listing taken in the same second the directory last changed is
+ * not trusted: a change right after it may have left the times as they were.
+ * @param path the directory
+ * @return the listing, owned by the cache; NULL if it cannot be read
+ */
+static Listing *get_listing(const char *path)
+{
+	struct stat st;
+	if (stat(path, &st) < 0 || !S_ISDIR(st.st_mode))
+		return NULL;
+	for (size_t i = 0; i < nlistings; i++)
+	{
+		Listing *dir = listings[i];
+		if (dir->dev != st.st_dev || dir->ino != st.st_ino)
+			continue;
+		if (same_time(dir->mtime, st.st_mtim) && same_time(dir->ctime, st.st_ctim) &&
+		    dir->listed.tv_sec > st.st_ctim.tv_sec)
+		{
+			dir->used = ++use_clock;
+			return dir;
+		}
+		// stale; one that is being walked stays, and the directory is listed anew
+		if (dir->busy)
+			break;
+		Listing *fresh = read_listing(path);
+		if (fresh == NULL)
+			return NULL;
+		free_listing(dir);
+		fresh->used = ++use_clock;
+		listings[i] = fresh;
+		return fresh;
+	}
+	Listing *dir = read_listing(path);
+	if (dir == NULL)
+		return NULL;
+	dir->used = ++use_clock;
+	cache_add(dir);
+	return dir;
+}
+
+/**
+ * Whether a pattern (or len bytes of it) has a character that matches
+ * anything but itself. A '[' only counts with a ']' after it.
+ */
+static int has_meta(const char *s, size_t len)
+{
+	for (size_t i = 0; i < len; i++)
+	{
+		if (s[i] == '\\' && i + 1 < len)
+			i++;
+		else if (s[i] == '*' || s[i] == '?')
+			return 1;
+		else if (s[i] == '[' && memchr(s + i + 1, ']', len - i - 1) != NULL)
+			return 1;
+	}
+	return 0;
+}
+
+// copy len bytes of a pattern to dest with the backslashes taken out; returns the length
+static size_t unescape(char *dest, const char *s, size_t len)
+{
+	size_t n = 0;
+	for (size_t i = 0; i < len; i++)
+	{
+		if (s[i] == '\\' && i + 1 < len)
+			i++;
+		dest[n++] = s[i];
+	}
+	dest[n] = '\0';
+	return n;
+}
+
+static void add_match(Glob *g, size_t len)
+{
+	if (g->npaths == g->cap)
+	{
+		g->cap = g->cap ? g->cap * 2 : 16;
+		g->paths = realloc(g->paths, sizeof(char *) * g->cap);
+	}
+	g->paths[g->npaths++] = arena_strndup(g->arena, g->path, len);
+}
+
+/**
+ * Match what is left of a pattern below the directory in g->path.
+ * @param g the matches so far
+ * @param len length of g->path, which ends with '/' unless it is empty
+ * @param pattern the rest of the pattern, starting with a component
+ */
+static void glob_below(Glob *g, size_t len, const char *pattern)
+{
+	const char *slash = strchr(pattern, '/');
+	size_t comp_len = slash != NULL ? (size_t)(slash - pattern) : strlen(pattern);
+	const char *rest = slash;
+	if (rest != NULL)
+		while (*rest == '/')
+			rest++;
+
+	if (!has_meta(pattern, comp_len))
+	{
+		// a plain component needs no listing, only to exist in the end
+		if (len + comp_len + 2 > sizeof(g->path))
+			return;
+		len += unescape(g->path + len, pattern, comp_len);
+		if (rest != NULL)
+		{
+			g->path[len++] = '/';
+			g->path[len] = '\0';
+			if (*rest == '\0')
+			{
+				struct stat st;
+				if (stat(g->path, &st) == 0 && S_ISDIR(st.st_mode))
+					add_match(g, len);
+			}
+			else
+				glob_below(g, len, rest);
+		}
+		else
+		{
+			struct stat st;
+			if (lstat(g->path, &st) == 0)
+				add_match(g, len);
+		}
+		return;
+	}
+
+	Listing *dir = get_listing(len > 0 ? g->path : ".");
+	if (dir == NULL)
+		return;
+	char *component = strndup(pattern, comp_len);
+	if (g->npaths > 0 || rest != NULL)
+		g->sort = 1;
+	dir->busy++;
+	for (size_t i = 0; i < dir->nnames; i++)
+	{
+		const char *name = dir->names[i];
+		// hidden files need the dot spelled out
+		if (fnmatch(component, name, FNM_PERIOD) != 0)
+			continue;
+		size_t name_len = strlen(name);
+		if (len + name_len + 2 > sizeof(g->path))
+			continue;
+		memcpy(g->path + len, name, name_len + 1);
+		if (rest == NULL)
+			add_match(g, len + name_len);
+		else if (*rest == '\0')
+		{
+			struct stat st;
+			g->path[len + name_len] = '/';
+			g->path[len + name_len + 1] = '\0';
+			if (stat(g->path, &st) == 0 && S_ISDIR(st.st_mode))
+				add_match(g, len + name_len + 1);
+		}
+		else
+		{
+			g->path[len + name_len] = '/';
+			g->path[len + name_len + 1] = '\0';
+			glob_below(g, len + name_len + 1, rest);
+		}
+	}
+	dir->busy--;
+	free(component);
+}
+
+/**
+ * Expand a pattern into the paths it matches, sorted in byte order. In the
+ * pattern, a backslash takes the meaning away from the character after it;
+ * expand_task() puts one in front of each quoted '*', '?', '[' and '\'.
+ * @param pattern the pattern
+ * @param arena where the paths and the array are allocated
+ * @param paths where the paths are stored
+ * @return the number of paths; with no match, 1 for the pattern itself
+ * with the backslashes taken out
+ */
+int glob_expand(const char *pattern, Arena *arena, char ***paths)
+{
+	size_t len = strlen(pattern);
+	if (!has_meta(pattern, len))
+	{
+		*paths = arena_alloc(arena, sizeof(char *));
+		(*paths)[0] = arena_alloc(arena, len + 1);
+		unescape((*paths)[0], pattern, len);
+		return 1;
+	}
+	Glob *g = calloc(1, sizeof(Glob));
+	g->arena = arena;
+	size_t start = 0;
+	if (pattern[0] == '/')
+	{
+		g->path[start++] = '/';
+		while (pattern[start] == '/')
+			start++;
+	}
+	glob_below(g, start > 0 ? 1 : 0, pattern + start);
+
+	int n = g->npaths;
+	if (n == 0)
+	{
+		*paths = arena_alloc(arena, sizeof(char *));
+		(*paths)[0] = arena_alloc(arena, len + 1);
+		unescape((*paths)[0], pattern, len);
+		n = 1;
+	}
+	else
+	{
+		// one directory's matches come sorted already, but "a/x" sorts after "a.b/y"
+		if (g->sort)
+			qsort(g->paths, g->npaths, sizeof(char *), compare_names);
+		*paths = arena_alloc(arena, sizeof(char *) * g->npaths);
+		memcpy(*paths, g->paths, sizeof(char *) * g->npaths);
+	}
+	free(g->paths);
+	free(g);
+	return n;
+}
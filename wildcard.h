@@ -0,0 +1,10 @@
+// wildcard.h: Pathname expansion of *, ? and [...]
+
+#ifndef WILDCARD_H
+#define WILDCARD_H
+
+#include "arena.h"
+
+int glob_expand(const char *pattern, Arena *arena, char ***paths);
+
+#endif